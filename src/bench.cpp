@@ -0,0 +1,353 @@
+// Microbenchmarks of the coroutine primitives from the exercises
+// - coroutine creation and destruction
+// - resume/suspend round trip
+// - nested `co_await` chains: eager tasks (exercise 8) and lazy tasks with symmetric transfer
+//   (exercise 11)
+// - per-element `generator<T>` cost (exercise 9)
+// - the `std::future` coroutine (exercise 1)
+// Every result is compared with plain function calls, `std::function` callbacks and threads.
+// Reported per operation: time, global allocations and allocated bytes (the frame size for
+// benchmarks creating a single coroutine).
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <new>
+#include <optional>
+#include <thread>
+#include <utility>
+
+
+// ********* ALLOCATION COUNTING *********
+
+// incremented by every thread that allocates
+inline std::atomic<std::size_t> global_allocations = 0;
+inline std::atomic<std::size_t> global_allocated_bytes = 0;
+
+void* operator new(std::size_t size)
+{
+  global_allocations.fetch_add(1, std::memory_order_relaxed);
+  global_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  if(void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+
+// ********* HARNESS *********
+
+template<typename T>
+inline void do_not_optimize(const T& value)
+{
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+template<std::invocable F>
+void bench(const char* name, std::size_t iterations, F&& op)
+{
+  for(std::size_t i = 0; i < iterations / 10 + 1; ++i) op();
+
+  const auto allocs_before = global_allocations.load();
+  const auto bytes_before = global_allocated_bytes.load();
+  const auto start = std::chrono::steady_clock::now();
+  for(std::size_t i = 0; i < iterations; ++i) op();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  const auto n = static_cast<double>(iterations);
+  std::printf("%-40s %10.2f ns/op %8.2f allocs/op %10.1f B/op\n", name,
+              std::chrono::duration<double, std::nano>(elapsed).count() / n,
+              static_cast<double>(global_allocations - allocs_before) / n,
+              static_cast<double>(global_allocated_bytes - bytes_before) / n);
+}
+
+void section(const char* name) { std::printf("\n%s\n", name); }
+
+
+// ********* CORO TYPES *********
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+// exercise 8: eager task, awaiting runs the callee on the caller's stack
+namespace eager {
+
+template<std::move_constructible T>
+struct [[nodiscard]] task {
+  struct promise_type {
+    std::optional<T> result;
+    static std::suspend_never initial_suspend() noexcept { return {}; }
+    static std::suspend_always final_suspend() noexcept { return {}; }
+    [[noreturn]] static void unhandled_exception() { throw; }
+    task get_return_object() noexcept { return this; }
+    void return_value(T v) noexcept { result = std::move(v); }
+  };
+
+  [[nodiscard]] const T& get_result() const noexcept { return *promise_->result; }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      static bool await_ready() noexcept { return true; }
+      static void await_suspend(std::coroutine_handle<>) noexcept {}
+      const T& await_resume() const noexcept { return *p_->result; }
+    };
+    return awaiter{promise_.get()};
+  }
+
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+}
+
+// exercise 11: lazy task resumed through symmetric transfer
+namespace lazy {
+
+template<std::move_constructible T>
+struct [[nodiscard]] task {
+  struct promise_type {
+    std::optional<T> result;
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    [[noreturn]] static void unhandled_exception() { throw; }
+    task get_return_object() noexcept { return this; }
+    void return_value(T v) noexcept { result = std::move(v); }
+  };
+
+  void start() const { std::coroutine_handle<promise_type>::from_promise(*promise_).resume(); }
+  [[nodiscard]] const T& get_result() const noexcept { return *promise_->result; }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      static bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        p_->continuation = caller;
+        return std::coroutine_handle<promise_type>::from_promise(*p_);
+      }
+      const T& await_resume() const noexcept { return *p_->result; }
+    };
+    return awaiter{promise_.get()};
+  }
+
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+}
+
+// exercise 9
+template<typename T>
+struct [[nodiscard]] generator {
+  struct promise_type {
+    T v;
+    generator get_return_object() noexcept { return this; }
+    auto await_transform(auto) = delete;
+    [[noreturn]] static void unhandled_exception() { throw; }
+    static void return_void() noexcept {}
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static std::suspend_always final_suspend() noexcept { return {}; }
+    std::suspend_always yield_value(T expr) noexcept
+    {
+      v = std::move(expr);
+      return {};
+    }
+  };
+
+  bool next()
+  {
+    auto handle = std::coroutine_handle<promise_type>::from_promise(*promise_);
+    handle.resume();
+    return !handle.done();
+  }
+  const T& value() const noexcept { return promise_->v; }
+
+private:
+  generator(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+// exercise 1
+template<typename R, typename... Args>
+struct std::coroutine_traits<std::future<R>, Args...> {
+  struct promise_type {
+    std::promise<R> p;
+    auto initial_suspend() { return std::suspend_never{}; }
+    auto final_suspend() noexcept { return std::suspend_never{}; }
+    void return_value(R v) { p.set_value(v); }
+    auto get_return_object() { return p.get_future(); }
+    void unhandled_exception() { p.set_exception(std::current_exception()); }
+  };
+};
+
+// a coroutine that suspends forever, used to measure plain resume/suspend
+struct [[nodiscard]] resumable {
+  struct promise_type {
+    resumable get_return_object() noexcept { return this; }
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static std::suspend_always final_suspend() noexcept { return {}; }
+    [[noreturn]] static void unhandled_exception() { throw; }
+    static void return_void() noexcept {}
+  };
+
+  void resume() const { std::coroutine_handle<promise_type>::from_promise(*promise_).resume(); }
+
+private:
+  resumable(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* SUBJECTS *********
+
+[[gnu::noinline]] int plain_leaf(int i) { return i; }
+
+lazy::task<int> lazy_leaf(int i) { co_return i; }
+
+resumable forever()
+{
+  while(true) co_await std::suspend_always{};
+}
+
+eager::task<int> eager_foo(int i) { co_return i; }
+eager::task<int> eager_bar(int i) { co_return co_await eager_foo(i) + 23; }
+eager::task<int> eager_baz(int i) { co_return co_await eager_bar(i) + 1; }
+eager::task<int> eager_run(int i) { co_return co_await eager_baz(i) + 1; }
+
+lazy::task<int> lazy_foo(int i) { co_return i; }
+lazy::task<int> lazy_bar(int i) { co_return co_await lazy_foo(i) + 23; }
+lazy::task<int> lazy_baz(int i) { co_return co_await lazy_bar(i) + 1; }
+lazy::task<int> lazy_run(int i) { co_return co_await lazy_baz(i) + 1; }
+
+[[gnu::noinline]] int plain_foo(int i) { return i; }
+[[gnu::noinline]] int plain_bar(int i) { return plain_foo(i) + 23; }
+[[gnu::noinline]] int plain_baz(int i) { return plain_bar(i) + 1; }
+[[gnu::noinline]] int plain_run(int i) { return plain_baz(i) + 1; }
+
+generator<int> iota(int count)
+{
+  for(int i = 0; i < count; ++i) co_yield i;
+}
+
+std::future<int> future_foo() { co_return 42; }
+
+
+// ********* MAIN *********
+
+int main()
+{
+  constexpr std::size_t n = 1'000'000;
+  int sink = 0;
+
+  section("create + destroy");
+  bench("plain function call", n, [&] { do_not_optimize(plain_leaf(sink)); });
+  bench("std::function construct + call", n, [&] {
+    std::function<int(int)> f = [big = std::array<int, 8>{}](int i) { return i + big[0]; };
+    do_not_optimize(f(sink));
+  });
+  bench("lazy task create + destroy", n, [&] { do_not_optimize(lazy_leaf(sink)); });
+  bench("lazy task create + run + destroy", n, [&] {
+    const auto t = lazy_leaf(sink);
+    t.start();
+    do_not_optimize(t.get_result());
+  });
+  bench("std::thread create + join", 1000, [] { std::thread([] {}).join(); });
+
+  section("resume + suspend");
+  {
+    const auto r = forever();
+    bench("coroutine resume", n, [&] { r.resume(); });
+  }
+  {
+    std::function<void()> callback = [&] { ++sink; };
+    bench("std::function call", n, [&] { callback(); });
+  }
+  {
+    // round trip between two threads blocking on the same atomic
+    std::atomic<int> flag{0};
+    std::jthread other([&](std::stop_token st) {
+      while(true) {
+        flag.wait(0, std::memory_order_acquire);
+        if(st.stop_requested()) return;
+        flag.store(0, std::memory_order_release);
+        flag.notify_one();
+      }
+    });
+    bench("thread handoff (atomic wait/notify)", n / 100, [&] {
+      flag.store(1, std::memory_order_release);
+      flag.notify_one();
+      flag.wait(1, std::memory_order_acquire);
+    });
+    other.request_stop();
+    flag.store(1, std::memory_order_release);
+    flag.notify_one();
+  }
+
+  section("nested co_await chain (run -> baz -> bar -> foo)");
+  bench("plain function chain", n, [&] { do_not_optimize(plain_run(sink)); });
+  bench("eager tasks (exercise 8)", n, [&] { do_not_optimize(eager_run(sink).get_result()); });
+  bench("lazy tasks (exercise 11)", n, [&] {
+    const auto t = lazy_run(sink);
+    t.start();
+    do_not_optimize(t.get_result());
+  });
+
+  section("generator, per element");
+  {
+    auto g = iota(std::numeric_limits<int>::max());
+    bench("plain function call", n, [&] { do_not_optimize(plain_leaf(sink)); });
+    bench("generator<int> next (exercise 9)", n, [&] {
+      g.next();
+      do_not_optimize(g.value());
+    });
+  }
+
+  section("std::future");
+  bench("std::future coroutine (exercise 1)", n, [] { do_not_optimize(future_foo().get()); });
+  bench("std::promise + get", n, [] {
+    std::promise<int> p;
+    auto f = p.get_future();
+    p.set_value(42);
+    do_not_optimize(f.get());
+  });
+  bench("std::async + get", 1000,
+        [] { do_not_optimize(std::async(std::launch::async, [] { return 42; }).get()); });
+}
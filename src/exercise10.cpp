@@ -0,0 +1,472 @@
+// - Make `co_await duration` stop blocking the OS thread
+//   - a sleeping coroutine registers its handle with a deadline and returns control to the run loop
+//   - the run loop resumes ready coroutines and sleeps only when there is nothing else to do
+// - Store pending timers in a hierarchical timer wheel
+//   - O(1) insert and cancel, no allocation per timer (the node lives in the awaiter)
+//   - destroying a suspended task cancels its timer, or removes it from the ready queue if the
+//     timer fired already
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <concepts>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* TIMER WHEEL *********
+
+// Intrusive doubly-linked node; it is embedded in the awaiter, so it lives in the suspended frame
+struct timer_node {
+  timer_node* prev = this;
+  timer_node* next = this;
+  std::uint64_t expiry = 0;  // in ticks
+  std::uint16_t bucket = 0;  // level * slots_per_level + slot, needed to clear the occupancy bit
+  bool queued = false;       // expired, the handle waits in the ready queue
+  std::coroutine_handle<> handle;
+
+  [[nodiscard]] bool linked() const noexcept { return next != this; }
+};
+
+// Hashed hierarchical timer wheel (Varghese & Lauck).
+// Every level has 256 slots and covers 8 bits of the tick counter, so 8 levels cover the whole
+// 64-bit tick range and no overflow list is needed.  A timer is stored on the level given by the
+// highest bit in which its expiry differs from the current tick and cascades down one or more levels
+// when the wheel reaches the start of its slot.
+class timer_wheel {
+public:
+  static constexpr int level_bits = 8;
+  static constexpr int levels = 64 / level_bits;
+  static constexpr std::size_t slots_per_level = std::size_t{1} << level_bits;
+
+  timer_wheel() noexcept
+  {
+    for(auto& head : buckets_) head.prev = head.next = &head;
+  }
+  timer_wheel(const timer_wheel&) = delete;
+  timer_wheel& operator=(const timer_wheel&) = delete;
+
+  [[nodiscard]] bool empty() const noexcept { return size_ == 0; }
+  [[nodiscard]] std::size_t size() const noexcept { return size_; }
+
+  // next tick to be processed
+  [[nodiscard]] std::uint64_t current() const noexcept { return current_; }
+
+  void insert(timer_node& n) noexcept
+  {
+    assert(!n.linked());
+    if(n.expiry < current_) n.expiry = current_;
+    const int level = n.expiry == current_ ? 0 : (std::bit_width(n.expiry ^ current_) - 1) / level_bits;
+    const auto slot = (n.expiry >> (level * level_bits)) & (slots_per_level - 1);
+    n.bucket = static_cast<std::uint16_t>(level * slots_per_level + slot);
+
+    timer_node& head = buckets_[n.bucket];
+    n.prev = head.prev;
+    n.next = &head;
+    head.prev->next = &n;
+    head.prev = &n;
+    occupied_[n.bucket / 64] |= std::uint64_t{1} << (n.bucket % 64);
+    ++size_;
+  }
+
+  void cancel(timer_node& n) noexcept
+  {
+    if(!n.linked()) return;
+    unlink(n);
+  }
+
+  // Tick of the earliest event the wheel has to process: either a level-0 expiry or a cascade of a
+  // higher level slot.  Expiries are never earlier than the returned value.
+  [[nodiscard]] std::optional<std::uint64_t> next_event() const noexcept
+  {
+    if(empty()) return std::nullopt;
+    std::optional<std::uint64_t> res;
+    for(int level = 0; level < levels; ++level) {
+      const int shift = level * level_bits;
+      const auto digit = (current_ >> shift) & (slots_per_level - 1);
+      const auto slot = first_occupied(level, digit);
+      if(!slot) continue;
+      const int upper = shift + level_bits;
+      const std::uint64_t window = upper >= 64 ? 0 : (current_ >> upper) << upper;
+      const std::uint64_t tick = window + (*slot << shift);
+      if(!res || tick < *res) res = tick;
+    }
+    return res;
+  }
+
+  // Processes all ticks up to and including `now`, calling `on_expired(node)` for every expired
+  // timer.  Empty stretches of the wheel are skipped in one step.
+  template<std::invocable<timer_node&> F>
+  void advance(std::uint64_t now, F&& on_expired)
+  {
+    while(current_ <= now) {
+      const auto next = next_event();
+      if(!next || *next > now) {
+        current_ = now + 1;
+        break;
+      }
+      current_ = *next;
+      process_tick(on_expired);
+      ++current_;
+    }
+  }
+
+private:
+  std::array<timer_node, levels * slots_per_level> buckets_;
+  std::array<std::uint64_t, levels * slots_per_level / 64> occupied_{};
+  std::uint64_t current_ = 0;
+  std::size_t size_ = 0;
+
+  void unlink(timer_node& n) noexcept
+  {
+    n.prev->next = n.next;
+    n.next->prev = n.prev;
+    n.prev = n.next = &n;
+    const timer_node& head = buckets_[n.bucket];
+    if(!head.linked()) occupied_[n.bucket / 64] &= ~(std::uint64_t{1} << (n.bucket % 64));
+    --size_;
+  }
+
+  [[nodiscard]] std::optional<std::uint64_t> first_occupied(int level, std::uint64_t from) const noexcept
+  {
+    const std::size_t words_per_level = slots_per_level / 64;
+    for(auto bit = from; bit < slots_per_level; bit = (bit | 63) + 1) {
+      const auto word = occupied_[level * words_per_level + bit / 64] >> (bit % 64);
+      if(word) return bit + std::countr_zero(word);
+    }
+    return std::nullopt;
+  }
+
+  template<typename F>
+  void process_tick(F& on_expired)
+  {
+    // cascade from the highest level whose slot starts at this tick
+    for(int level = levels - 1; level > 0; --level) {
+      const int shift = level * level_bits;
+      if(current_ & ((std::uint64_t{1} << shift) - 1)) continue;
+      const auto slot = (current_ >> shift) & (slots_per_level - 1);
+      timer_node& head = buckets_[level * slots_per_level + slot];
+      while(head.linked()) {
+        timer_node& n = *head.next;
+        unlink(n);
+        insert(n);
+      }
+    }
+    timer_node& head = buckets_[current_ & (slots_per_level - 1)];
+    while(head.linked()) {
+      timer_node& n = *head.next;
+      unlink(n);
+      on_expired(n);
+    }
+  }
+};
+
+
+// ********* RUN LOOP *********
+
+class event_loop {
+public:
+  using clock = std::chrono::steady_clock;
+  using tick = std::chrono::milliseconds;
+
+  event_loop() : epoch_(clock::now())
+  {
+    assert(current_ == nullptr);
+    current_ = this;
+  }
+  ~event_loop() { current_ = nullptr; }
+  event_loop(const event_loop&) = delete;
+  event_loop& operator=(const event_loop&) = delete;
+
+  // the loop owned by the calling thread
+  [[nodiscard]] static event_loop& current() noexcept
+  {
+    assert(current_);
+    return *current_;
+  }
+
+  void post(std::coroutine_handle<> h) { ready_.push_back(h); }
+  // for a coroutine destroyed before the loop resumed it
+  void unpost(std::coroutine_handle<> h) { std::erase(ready_, h); }
+
+  void add_timer(timer_node& n, clock::time_point deadline) noexcept
+  {
+    // round up so that we never wake up before the deadline
+    n.expiry = static_cast<std::uint64_t>(std::chrono::ceil<tick>(deadline - epoch_).count());
+    wheel_.insert(n);
+  }
+  void cancel_timer(timer_node& n) noexcept { wheel_.cancel(n); }
+
+  [[nodiscard]] std::size_t pending_timers() const noexcept { return wheel_.size(); }
+
+  // runs until there is no ready coroutine and no pending timer left
+  void run()
+  {
+    while(!ready_.empty() || !wheel_.empty()) {
+      while(!ready_.empty()) {
+        auto h = ready_.front();
+        ready_.pop_front();
+        h.resume();
+      }
+      fire_expired();
+      if(ready_.empty() && !wheel_.empty()) {
+        std::this_thread::sleep_until(epoch_ + tick(*wheel_.next_event()));
+        fire_expired();
+      }
+    }
+  }
+
+private:
+  inline static thread_local event_loop* current_ = nullptr;
+  std::deque<std::coroutine_handle<>> ready_;
+  timer_wheel wheel_;
+  clock::time_point epoch_;
+
+  void fire_expired()
+  {
+    const auto now = std::chrono::floor<tick>(clock::now() - epoch_).count();
+    if(now < 0) return;
+    wheel_.advance(static_cast<std::uint64_t>(now), [&](timer_node& n) {
+      n.queued = true;
+      post(n.handle);
+    });
+  }
+};
+
+template<typename Rep, typename Period>
+struct sleep_awaiter {
+  std::chrono::duration<Rep, Period> duration;
+  timer_node node{};
+
+  sleep_awaiter(std::chrono::duration<Rep, Period> d) : duration(d) {}
+  sleep_awaiter(const sleep_awaiter&) = delete;
+  sleep_awaiter& operator=(const sleep_awaiter&) = delete;
+  // the node is unlinked, or its handle dropped from the ready queue, whenever the frame holding a
+  // suspended awaiter is destroyed
+  ~sleep_awaiter()
+  {
+    if(node.linked())
+      event_loop::current().cancel_timer(node);
+    else if(node.queued)
+      event_loop::current().unpost(node.handle);
+  }
+
+  bool await_ready() const noexcept { return duration <= duration.zero(); }
+  void await_suspend(std::coroutine_handle<> coro) noexcept
+  {
+    node.handle = coro;
+    event_loop::current().add_timer(node, event_loop::clock::now() + duration);
+  }
+  void await_resume() noexcept { node.queued = false; }
+};
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+template<typename T>
+class storage {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const & { return *result; }
+  [[nodiscard]] T&& get() && { return *std::move(result); }
+};
+
+template<>
+class storage<void> {
+public:
+  void get() const {}
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  [[noreturn]] void unhandled_exception() { throw; }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T> {
+    static std::suspend_never initial_suspend() noexcept { return {}; }
+    static std::suspend_always final_suspend() noexcept { return {}; }
+    task get_return_object() noexcept { return this; }
+
+    template<typename Rep, typename Period>
+    auto await_transform(std::chrono::duration<Rep, Period> d) { return sleep_awaiter<Rep, Period>(d); }
+
+    template<typename Awaitable>
+    decltype(auto) await_transform(Awaitable&& x) {
+        return std::forward<Awaitable>(x);
+    }
+  };
+
+  [[nodiscard]] bool done() const noexcept
+  {
+    return std::coroutine_handle<promise_type>::from_promise(*promise_).done();
+  }
+  [[nodiscard]] decltype(auto) get_result() const & noexcept
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() const && noexcept
+  {
+    return std::move(promise_)->get();
+  }
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+task<void> foo(int id)
+{
+  std::cout << id << ": about to sleep\n";
+  co_await 20ms;
+  std::cout << id << ": about to sleep again\n";
+  auto dur = 10ms;
+  co_await dur;
+  std::cout << id << ": about to return\n";
+}
+
+task<void> sleeper(std::chrono::milliseconds d, int& woken)
+{
+  co_await d;
+  ++woken;
+}
+
+// started first, its timer fires first and it is resumed before the victim
+task<void> killer(std::chrono::milliseconds d, std::optional<task<void>>& victim)
+{
+  co_await d;
+  victim.reset();
+}
+
+int main()
+{
+  event_loop loop;
+
+  // two coroutines interleave on one thread
+  {
+    auto a = foo(1);
+    auto b = foo(2);
+    loop.run();
+  }
+
+  // 10k concurrently sleeping tasks on one thread take as long as the longest sleep
+  {
+    constexpr int count = 10'000;
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist(1, 100);
+    int woken = 0;
+    std::vector<task<void>> tasks;
+    tasks.reserve(count);
+    const auto start = event_loop::clock::now();
+    for(int i = 0; i < count; ++i) tasks.push_back(sleeper(std::chrono::milliseconds(dist(gen)), woken));
+    loop.run();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(event_loop::clock::now() - start);
+    std::cout << woken << " tasks woken after " << elapsed.count() << "ms\n";
+  }
+
+  // destroying a suspended task cancels its timer
+  {
+    int woken = 0;
+    {
+      auto t = sleeper(1h, woken);
+      std::cout << "pending timers: " << loop.pending_timers() << "\n";
+    }
+    std::cout << "pending timers after destroy: " << loop.pending_timers() << "\n";
+  }
+
+  // destroying a task whose timer fired, before the loop resumed it
+  {
+    int woken = 0;
+    std::optional<task<void>> victim;
+    const auto k = killer(5ms, victim);
+    victim.emplace(sleeper(5ms, woken));
+    loop.run();
+    std::cout << "woken after destroy in the ready queue: " << woken << "\n";
+  }
+
+  // 1M pending timers on one wheel
+  {
+    constexpr std::size_t count = 1'000'000;
+    std::mt19937_64 gen(42);
+    std::uniform_int_distribution<std::uint64_t> dist(1, std::uint64_t{1} << 40);
+    std::vector<timer_node> nodes(count);
+    timer_wheel wheel;
+
+    const auto t0 = event_loop::clock::now();
+    for(auto& n : nodes) {
+      n.expiry = dist(gen);
+      wheel.insert(n);
+    }
+    const auto t1 = event_loop::clock::now();
+    for(auto& n : nodes) wheel.cancel(n);
+    const auto t2 = event_loop::clock::now();
+
+    const auto per_op = [&](auto d) { return std::chrono::duration<double, std::nano>(d).count() / count; };
+    std::cout << count << " timers: insert " << per_op(t1 - t0) << "ns/op, cancel " << per_op(t2 - t1)
+              << "ns/op, pending " << wheel.size() << "\n";
+  }
+}
@@ -0,0 +1,233 @@
+// - Make `task<T>` lazy
+//   - the coroutine suspends at its initial suspend point and starts only when awaited
+// - Awaiting a task stores the awaiting coroutine as a continuation in the promise
+//   - `await_suspend()` returns the awaited task's handle (symmetric transfer)
+//   - `final_suspend()` transfers control back to the continuation
+//   - awaiting a chain of nested tasks uses constant stack
+// - Exceptions are stored in the promise and rethrown in the awaiting coroutine
+//   - rethrowing from `unhandled_exception()` is no longer an option as the task is resumed by
+//     its callee rather than by the code that awaits it
+
+#include <concepts>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <utility>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return *result;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+  };
+
+  // starts the task from a non-coroutine context; returns once it suspends for the first time
+  void start() const
+  {
+    std::coroutine_handle<promise_type>::from_promise(*promise_).resume();
+  }
+  [[nodiscard]] bool done() const noexcept
+  {
+    return std::coroutine_handle<promise_type>::from_promise(*promise_).done();
+  }
+
+  [[nodiscard]] decltype(auto) get_result() const &
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() const &&
+  {
+    return std::move(promise_)->get();
+  }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      bool await_ready() const noexcept
+      {
+        return std::coroutine_handle<promise_type>::from_promise(*p_).done();
+      }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        p_->continuation = caller;
+        return std::coroutine_handle<promise_type>::from_promise(*p_);
+      }
+      decltype(auto) await_resume() const { return std::move(*p_).get(); }
+    };
+    return awaiter{promise_.get()};
+  }
+
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <iostream>
+#include <stdexcept>
+
+task<int> foo()
+{
+  co_return 42;
+}
+
+task<int> bar()
+{
+  const int res = co_await foo();
+  std::cout << "Result of foo: " << res << "\n";
+  co_return res + 23;
+}
+
+task<void> baz()
+{
+  const auto res = co_await bar();
+  std::cout << "Result of bar: " << res << "\n";
+}
+
+task<void> run()
+{
+  co_await baz();
+}
+
+task<int> chain(int depth)
+{
+  if(depth == 0) co_return 0;
+  co_return co_await chain(depth - 1) + 1;
+}
+
+task<int> fail()
+{
+  throw std::runtime_error("failed");
+  co_return 0;
+}
+
+task<void> catcher()
+{
+  try {
+    co_await fail();
+  }
+  catch(const std::exception& ex) {
+    std::cout << "Caught: " << ex.what() << "\n";
+  }
+}
+
+int main()
+{
+  const auto t = run();
+  t.start();
+
+  // would overflow the stack without symmetric transfer
+  const auto c = chain(1'000'000);
+  c.start();
+  std::cout << "Chain depth: " << c.get_result() << "\n";
+
+  const auto e = catcher();
+  e.start();
+}
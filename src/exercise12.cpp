@@ -0,0 +1,442 @@
+// - Spread `task<T>` work across cores with a work-stealing thread pool
+//   - every worker owns a Chase-Lev deque: the owner pushes and pops at the bottom, idle workers
+//     steal from the top
+//   - handles posted from outside the pool go through a shared injection queue
+//   - idle workers park on an atomic epoch counter instead of spinning
+// - `co_await schedule_on(pool)` moves the current coroutine onto a pool worker
+//   - a coroutine scheduled from inside the pool is pushed onto the local deque of the worker
+//     that scheduled it, continuations are resumed inline by symmetric transfer
+
+#include <atomic>
+#include <concepts>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return *result;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+  };
+
+  [[nodiscard]] decltype(auto) get_result() const &
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() const &&
+  {
+    return std::move(promise_)->get();
+  }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      bool await_ready() const noexcept
+      {
+        return std::coroutine_handle<promise_type>::from_promise(*p_).done();
+      }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        p_->continuation = caller;
+        return std::coroutine_handle<promise_type>::from_promise(*p_);
+      }
+      decltype(auto) await_resume() const { return std::move(*p_).get(); }
+    };
+    return awaiter{promise_.get()};
+  }
+
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* WORK-STEALING DEQUE *********
+
+// Chase-Lev deque with the memory orderings from Lê et al., "Correct and Efficient Work-Stealing
+// for Weak Memory Models" (PPoPP 2013).  Only the owner calls `push()`/`pop()`, any thread may call
+// `steal()`.  Outgrown rings are kept alive until the deque is destroyed as thieves may still read them.
+class chase_lev_deque {
+public:
+  explicit chase_lev_deque(std::size_t capacity = 256)
+  {
+    rings_.push_back(std::make_unique<ring>(static_cast<std::int64_t>(capacity)));
+    ring_.store(rings_.back().get(), std::memory_order_relaxed);
+  }
+  chase_lev_deque(const chase_lev_deque&) = delete;
+  chase_lev_deque& operator=(const chase_lev_deque&) = delete;
+
+  void push(std::coroutine_handle<> h)
+  {
+    const auto b = bottom_.load(std::memory_order_relaxed);
+    const auto t = top_.load(std::memory_order_acquire);
+    ring* r = ring_.load(std::memory_order_relaxed);
+    if(b - t > r->capacity - 1) r = grow(r, t, b);
+    r->put(b, h.address());
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  std::coroutine_handle<> pop() noexcept
+  {
+    const auto b = bottom_.load(std::memory_order_relaxed) - 1;
+    ring* r = ring_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto t = top_.load(std::memory_order_relaxed);
+    if(t > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    void* x = r->get(b);
+    if(t == b) {
+      // last element, race against thieves
+      if(!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        x = nullptr;
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return std::coroutine_handle<>::from_address(x);
+  }
+
+  std::coroutine_handle<> steal() noexcept
+  {
+    auto t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const auto b = bottom_.load(std::memory_order_acquire);
+    if(t >= b) return nullptr;
+    const ring* r = ring_.load(std::memory_order_acquire);
+    void* x = r->get(t);
+    if(!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+      return nullptr;
+    return std::coroutine_handle<>::from_address(x);
+  }
+
+private:
+  struct ring {
+    std::int64_t capacity;
+    std::unique_ptr<std::atomic<void*>[]> slots;
+
+    explicit ring(std::int64_t cap) : capacity(cap), slots(new std::atomic<void*>[static_cast<std::size_t>(cap)]) {}
+    void put(std::int64_t i, void* x) noexcept { slots[static_cast<std::size_t>(i & (capacity - 1))].store(x, std::memory_order_relaxed); }
+    void* get(std::int64_t i) const noexcept { return slots[static_cast<std::size_t>(i & (capacity - 1))].load(std::memory_order_relaxed); }
+  };
+
+  alignas(64) std::atomic<std::int64_t> top_{0};
+  alignas(64) std::atomic<std::int64_t> bottom_{0};
+  std::atomic<ring*> ring_;
+  std::vector<std::unique_ptr<ring>> rings_;
+
+  ring* grow(ring* old, std::int64_t t, std::int64_t b)
+  {
+    auto bigger = std::make_unique<ring>(old->capacity * 2);
+    for(auto i = t; i != b; ++i) bigger->put(i, old->get(i));
+    ring* r = bigger.get();
+    rings_.push_back(std::move(bigger));
+    ring_.store(r, std::memory_order_release);
+    return r;
+  }
+};
+
+
+// ********* THREAD POOL *********
+
+class thread_pool {
+public:
+  explicit thread_pool(std::size_t threads = std::thread::hardware_concurrency())
+  {
+    if(threads == 0) threads = 1;
+    workers_.reserve(threads);
+    for(std::size_t i = 0; i < threads; ++i) workers_.push_back(std::make_unique<worker>());
+    for(std::size_t i = 0; i < threads; ++i) workers_[i]->thread = std::thread([this, i] { run(i); });
+  }
+  ~thread_pool()
+  {
+    stop_.store(true);
+    epoch_.fetch_add(1);
+    epoch_.notify_all();
+    for(auto& w : workers_) w->thread.join();
+  }
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+
+  [[nodiscard]] std::size_t size() const noexcept { return workers_.size(); }
+
+  void post(std::coroutine_handle<> h)
+  {
+    if(current_pool_ == this)
+      workers_[current_index_]->deque.push(h);
+    else {
+      std::lock_guard lock(inject_mutex_);
+      injected_.push_back(h);
+    }
+    epoch_.fetch_add(1);
+    if(sleeping_.load() > 0) epoch_.notify_one();
+  }
+
+  [[nodiscard]] auto schedule() noexcept
+  {
+    struct awaiter {
+      thread_pool& pool;
+      static bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) const { pool.post(h); }
+      static void await_resume() noexcept {}
+    };
+    return awaiter{*this};
+  }
+
+private:
+  struct worker {
+    chase_lev_deque deque;
+    std::thread thread;
+  };
+
+  inline static thread_local thread_pool* current_pool_ = nullptr;
+  inline static thread_local std::size_t current_index_ = 0;
+
+  std::vector<std::unique_ptr<worker>> workers_;
+  std::mutex inject_mutex_;
+  std::deque<std::coroutine_handle<>> injected_;
+  std::atomic<bool> stop_{false};
+  std::atomic<std::uint32_t> epoch_{0};
+  std::atomic<std::uint32_t> sleeping_{0};
+
+  std::coroutine_handle<> find_work(std::size_t index, std::minstd_rand& rng)
+  {
+    if(auto h = workers_[index]->deque.pop()) return h;
+    {
+      std::lock_guard lock(inject_mutex_);
+      if(!injected_.empty()) {
+        auto h = injected_.front();
+        injected_.pop_front();
+        return h;
+      }
+    }
+    const auto count = workers_.size();
+    const auto start = rng() % count;
+    for(std::size_t i = 0; i < count; ++i) {
+      const auto victim = (start + i) % count;
+      if(victim == index) continue;
+      if(auto h = workers_[victim]->deque.steal()) return h;
+    }
+    return nullptr;
+  }
+
+  void run(std::size_t index)
+  {
+    current_pool_ = this;
+    current_index_ = index;
+    std::minstd_rand rng(static_cast<std::minstd_rand::result_type>(index + 1));
+    while(true) {
+      if(auto h = find_work(index, rng)) {
+        h.resume();
+        continue;
+      }
+      // announce that we are about to sleep, then look once more so that no post is missed
+      sleeping_.fetch_add(1);
+      const auto e = epoch_.load();
+      if(stop_.load()) {
+        sleeping_.fetch_sub(1);
+        return;
+      }
+      if(auto h = find_work(index, rng)) {
+        sleeping_.fetch_sub(1);
+        h.resume();
+        continue;
+      }
+      epoch_.wait(e);
+      sleeping_.fetch_sub(1);
+    }
+  }
+};
+
+[[nodiscard]] inline auto schedule_on(thread_pool& pool) noexcept { return pool.schedule(); }
+
+
+// ********* EXAMPLE *********
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <latch>
+
+// fire-and-forget coroutine used to start a task and signal its completion
+struct detached {
+  struct promise_type {
+    static std::suspend_never initial_suspend() noexcept { return {}; }
+    static std::suspend_never final_suspend() noexcept { return {}; }
+    static detached get_return_object() noexcept { return {}; }
+    static void return_void() noexcept {}
+    [[noreturn]] static void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+template<typename T>
+detached spawn(task<T> t, std::latch& done)
+{
+  co_await t;
+  done.count_down();
+}
+
+task<double> compute(int seed)
+{
+  double acc = 0;
+  for(int i = 1; i < 20'000; ++i) acc += std::sqrt(static_cast<double>(i ^ seed));
+  co_return acc;
+}
+
+task<void> work(thread_pool& pool, int seed, std::atomic<double>& sum)
+{
+  co_await schedule_on(pool);
+  // continues on a pool worker; `compute()` runs on the same worker
+  const auto res = co_await compute(seed);
+  sum.fetch_add(res);
+}
+
+const auto main_thread = std::this_thread::get_id();
+
+task<void> where(thread_pool& pool)
+{
+  std::cout << "started on main thread: " << (std::this_thread::get_id() == main_thread) << "\n";
+  co_await schedule_on(pool);
+  std::cout << "resumed on main thread: " << (std::this_thread::get_id() == main_thread) << "\n";
+}
+
+int main()
+{
+  {
+    std::latch done(1);
+    thread_pool pool(2);
+    spawn(where(pool), done);
+    done.wait();
+  }
+
+  constexpr int tasks = 4'000;
+  const auto max_threads = std::max(1u, std::thread::hardware_concurrency());
+  double base = 0;
+  for(unsigned threads = 1; threads <= max_threads; threads *= 2) {
+    std::latch done(tasks);
+    std::atomic<double> sum = 0;
+    thread_pool pool(threads);
+    const auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < tasks; ++i) spawn(work(pool, i, sum), done);
+    done.wait();
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const auto throughput = tasks / elapsed;
+    if(threads == 1) base = throughput;
+    std::cout << threads << " threads: " << static_cast<long>(throughput) << " tasks/s, speedup "
+              << throughput / base << "\n";
+  }
+}
@@ -0,0 +1,417 @@
+// - Allocate coroutine frames from a thread-local pool instead of global `operator new`
+//   - `promise_type` provides `operator new`/`operator delete` overloads
+//   - frames are bucketed into power-of-two size classes, bigger frames fall back to global new
+//   - every block remembers the pool it came from
+//     - frees on the owning thread go to a plain free list
+//     - frees from other threads are pushed to the owner's lock-free remote list
+//   - pools of exited threads are never freed but adopted by new threads, so remote frees never
+//     see a dead pool
+// - Compare the cost per coroutine against the default allocator
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <utility>
+#include <vector>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* FRAME POOL *********
+
+class frame_pool {
+public:
+  static constexpr std::size_t min_size_log2 = 6;  // 64 bytes
+  static constexpr std::size_t max_size_log2 = 12; // 4 KiB
+  static constexpr std::size_t size_classes = max_size_log2 - min_size_log2 + 1;
+
+  [[nodiscard]] static void* allocate(std::size_t size)
+  {
+    const auto cls = size_class(size);
+    if(cls == size_classes) {
+      auto* h = new(::operator new(sizeof(header) + size)) header{nullptr, cls};
+      return h + 1;
+    }
+    return local().allocate_from(cls);
+  }
+
+  static void deallocate(void* ptr) noexcept
+  {
+    auto* h = static_cast<header*>(ptr) - 1;
+    if(!h->owner) {
+      ::operator delete(h);
+      return;
+    }
+    frame_pool& pool = local();
+    if(h->owner == &pool)
+      pool.push_local(h);
+    else
+      h->owner->push_remote(h);
+  }
+
+private:
+  // placed in front of every frame; keeps the frame aligned to the default new alignment
+  struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) header {
+    frame_pool* owner;
+    std::size_t cls;
+  };
+  struct free_block {
+    free_block* next;
+  };
+
+  std::array<free_block*, size_classes> local_{};
+  std::array<std::atomic<free_block*>, size_classes> remote_{};
+
+  // ownership handover of pools whose threads exited
+  inline static std::mutex orphans_mutex_;
+  inline static std::vector<frame_pool*> orphans_;
+
+  struct local_holder {
+    frame_pool* pool;
+    local_holder()
+    {
+      std::lock_guard lock(orphans_mutex_);
+      if(orphans_.empty())
+        pool = new frame_pool;
+      else {
+        pool = orphans_.back();
+        orphans_.pop_back();
+      }
+    }
+    ~local_holder()
+    {
+      std::lock_guard lock(orphans_mutex_);
+      orphans_.push_back(pool);
+    }
+  };
+
+  static frame_pool& local()
+  {
+    thread_local local_holder holder;
+    return *holder.pool;
+  }
+
+  static constexpr std::size_t size_class(std::size_t size) noexcept
+  {
+    const auto total = size + sizeof(header);
+    if(total > (std::size_t{1} << max_size_log2)) return size_classes;
+    const auto log2 = static_cast<std::size_t>(std::bit_width(total - 1));
+    return log2 < min_size_log2 ? 0 : log2 - min_size_log2;
+  }
+
+  void* allocate_from(std::size_t cls)
+  {
+    free_block* b = local_[cls];
+    if(!b) b = remote_[cls].exchange(nullptr, std::memory_order_acquire);
+    void* mem;
+    if(b) {
+      local_[cls] = b->next;
+      mem = b;
+    }
+    else
+      mem = ::operator new(std::size_t{1} << (cls + min_size_log2));
+    auto* h = new(mem) header{this, cls};
+    return h + 1;
+  }
+
+  void push_local(header* h) noexcept
+  {
+    const auto cls = h->cls;
+    local_[cls] = new(h) free_block{local_[cls]};
+  }
+
+  void push_remote(header* h) noexcept
+  {
+    auto& head = remote_[h->cls];
+    auto* b = new(h) free_block{head.load(std::memory_order_relaxed)};
+    while(!head.compare_exchange_weak(b->next, b, std::memory_order_release, std::memory_order_relaxed)) {}
+  }
+};
+
+// base class for promise types that allocate their frames from the frame pool
+struct pooled_frame {
+  static void* operator new(std::size_t size) { return frame_pool::allocate(size); }
+  static void operator delete(void* ptr, std::size_t) noexcept { frame_pool::deallocate(ptr); }
+};
+
+// base class for promise types that use global `operator new`
+struct default_frame {};
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return *result;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T, typename FrameAlloc = pooled_frame>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T>, FrameAlloc {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+  };
+
+  void start() const
+  {
+    std::coroutine_handle<promise_type>::from_promise(*promise_).resume();
+  }
+
+  [[nodiscard]] decltype(auto) get_result() const &
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() const &&
+  {
+    return std::move(promise_)->get();
+  }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      bool await_ready() const noexcept
+      {
+        return std::coroutine_handle<promise_type>::from_promise(*p_).done();
+      }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        p_->continuation = caller;
+        return std::coroutine_handle<promise_type>::from_promise(*p_);
+      }
+      decltype(auto) await_resume() const { return std::move(*p_).get(); }
+    };
+    return awaiter{promise_.get()};
+  }
+
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* GENERATOR *********
+
+template<typename T, typename FrameAlloc = pooled_frame>
+struct [[nodiscard]] generator {
+
+  struct promise_type;
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  struct promise_type : FrameAlloc {
+    T v;
+
+    generator get_return_object() {
+        return {this};
+    }
+    auto await_transform(auto) = delete;
+    void unhandled_exception() { throw; }
+    void return_void() noexcept {}
+
+    std::suspend_always initial_suspend() noexcept { return {}; };
+    std::suspend_always final_suspend() noexcept { return {}; }
+
+    std::suspend_always yield_value(auto expr) {
+        v = expr;
+        return {};
+    }
+  };
+
+  generator(promise_type* p): promise_(p) {}
+
+  bool next() {
+    auto handle = handle_type::from_promise(*promise_);
+    handle.resume();
+    return !handle.done();
+  }
+
+  T value() {
+    return promise_->v;
+  }
+private:
+  // the frame is destroyed with the generator, otherwise it would never go back to the pool
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+// count calls to the global allocator, from every thread
+inline std::atomic<std::size_t> global_allocations = 0;
+
+void* operator new(std::size_t size)
+{
+  global_allocations.fetch_add(1, std::memory_order_relaxed);
+  if(void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+template<typename FrameAlloc>
+task<int, FrameAlloc> leaf(int i)
+{
+  co_return i;
+}
+
+template<typename FrameAlloc>
+task<int, FrameAlloc> parent(int i)
+{
+  co_return co_await leaf<FrameAlloc>(i) + 1;
+}
+
+template<typename FrameAlloc>
+generator<int, FrameAlloc> simple()
+{
+  co_yield 1;
+  co_yield 2;
+}
+
+template<typename FrameAlloc>
+void benchmark(const char* name)
+{
+  constexpr int iterations = 1'000'000;
+  long sum = 0;
+  const auto allocs_before = global_allocations.load();
+  const auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < iterations; ++i) {
+    const auto t = parent<FrameAlloc>(i);
+    t.start();
+    sum += t.get_result();
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  const auto allocs = global_allocations - allocs_before;
+  // every iteration creates two coroutines
+  std::cout << name << ": " << std::chrono::duration<double, std::nano>(elapsed).count() / (2 * iterations)
+            << " ns/coroutine, " << static_cast<double>(allocs) / (2 * iterations) << " global allocations/coroutine"
+            << " (checksum " << sum << ")\n";
+}
+
+int main()
+{
+  {
+    auto g = simple<pooled_frame>();
+    while(g.next())
+      std::cout << g.value() << ' ';
+    std::cout << '\n';
+  }
+
+  benchmark<default_frame>("default allocator");
+  benchmark<pooled_frame>("frame pool       ");
+
+  // frames created on one thread and destroyed on another go back to the creating thread's pool
+  {
+    std::vector<task<int>> tasks;
+    for(int i = 0; i < 1000; ++i) tasks.push_back(parent<pooled_frame>(i));
+    std::thread([&] { tasks.clear(); }).join();
+    const auto allocs_before = global_allocations.load();
+    for(int i = 0; i < 1000; ++i) tasks.push_back(parent<pooled_frame>(i));
+    std::cout << "global allocations after cross-thread free: " << global_allocations - allocs_before << "\n";
+  }
+}
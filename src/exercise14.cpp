@@ -0,0 +1,349 @@
+// - Let the caller decide where a coroutine frame lives
+//   - a coroutine taking `std::allocator_arg_t, Alloc` as its leading parameters allocates its
+//     frame from that allocator (`std::pmr::memory_resource*` or `std::pmr::polymorphic_allocator`)
+//   - coroutines without an allocator argument use `std::pmr::new_delete_resource()`
+// - The memory resource is stored behind the frame
+//   - `operator delete` finds it there, so `promise_ptr`/`coro_deleter` work unchanged
+// - A request-scoped arena can hold a whole tree of nested tasks and release it in one shot
+
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <utility>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* FRAME ALLOCATOR *********
+
+inline std::pmr::memory_resource* to_memory_resource(std::pmr::memory_resource* r) noexcept { return r; }
+
+template<typename T>
+std::pmr::memory_resource* to_memory_resource(const std::pmr::polymorphic_allocator<T>& a) noexcept
+{
+  return a.resource();
+}
+
+template<typename Alloc>
+concept frame_allocator_for = requires(const Alloc& a) {
+  { to_memory_resource(a) } -> std::same_as<std::pmr::memory_resource*>;
+};
+
+// base class for promise types
+class allocator_aware_frame {
+  static constexpr std::size_t alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+  // the resource pointer is stored right behind the frame
+  static constexpr std::size_t resource_offset(std::size_t size) noexcept
+  {
+    constexpr auto align = alignof(std::pmr::memory_resource*);
+    return (size + align - 1) & ~(align - 1);
+  }
+  static constexpr std::size_t allocation_size(std::size_t size) noexcept
+  {
+    return resource_offset(size) + sizeof(std::pmr::memory_resource*);
+  }
+
+  static void* allocate(std::size_t size, std::pmr::memory_resource* mr)
+  {
+    void* ptr = mr->allocate(allocation_size(size), alignment);
+    std::memcpy(static_cast<std::byte*>(ptr) + resource_offset(size), &mr, sizeof(mr));
+    return ptr;
+  }
+
+public:
+  static void* operator new(std::size_t size)
+  {
+    return allocate(size, std::pmr::new_delete_resource());
+  }
+
+  // free function coroutine: `task<T> foo(std::allocator_arg_t, Alloc, Args...)`
+  template<frame_allocator_for Alloc, typename... Args>
+  static void* operator new(std::size_t size, std::allocator_arg_t, const Alloc& alloc, const Args&...)
+  {
+    return allocate(size, to_memory_resource(alloc));
+  }
+
+  // member function coroutine: the implicit object parameter comes first
+  template<typename Self, frame_allocator_for Alloc, typename... Args>
+  static void* operator new(std::size_t size, const Self&, std::allocator_arg_t, const Alloc& alloc, const Args&...)
+  {
+    return allocate(size, to_memory_resource(alloc));
+  }
+
+  static void operator delete(void* ptr, std::size_t size) noexcept
+  {
+    std::pmr::memory_resource* mr;
+    std::memcpy(&mr, static_cast<std::byte*>(ptr) + resource_offset(size), sizeof(mr));
+    mr->deallocate(ptr, allocation_size(size), alignment);
+  }
+};
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return *result;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T>, allocator_aware_frame {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+  };
+
+  void start() const
+  {
+    std::coroutine_handle<promise_type>::from_promise(*promise_).resume();
+  }
+
+  [[nodiscard]] decltype(auto) get_result() const &
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() const &&
+  {
+    return std::move(promise_)->get();
+  }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      bool await_ready() const noexcept
+      {
+        return std::coroutine_handle<promise_type>::from_promise(*p_).done();
+      }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        p_->continuation = caller;
+        return std::coroutine_handle<promise_type>::from_promise(*p_);
+      }
+      decltype(auto) await_resume() const { return std::move(*p_).get(); }
+    };
+    return awaiter{promise_.get()};
+  }
+
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* GENERATOR *********
+
+template<typename T>
+struct [[nodiscard]] generator {
+
+  struct promise_type;
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  struct promise_type : allocator_aware_frame {
+    T v;
+
+    generator get_return_object() {
+        return {this};
+    }
+    auto await_transform(auto) = delete;
+    void unhandled_exception() { throw; }
+    void return_void() noexcept {}
+
+    std::suspend_always initial_suspend() noexcept { return {}; };
+    std::suspend_always final_suspend() noexcept { return {}; }
+
+    std::suspend_always yield_value(auto expr) {
+        v = expr;
+        return {};
+    }
+  };
+
+  generator(promise_type* p): promise_(p) {}
+
+  bool next() {
+    auto handle = handle_type::from_promise(*promise_);
+    handle.resume();
+    return !handle.done();
+  }
+
+  T value() {
+    return promise_->v;
+  }
+private:
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <array>
+#include <iostream>
+
+// forwards to an upstream resource and counts what goes through it
+class counting_resource : public std::pmr::memory_resource {
+public:
+  explicit counting_resource(std::pmr::memory_resource* upstream) : upstream_(upstream) {}
+  std::size_t allocations = 0;
+  std::size_t bytes = 0;
+private:
+  std::pmr::memory_resource* upstream_;
+
+  void* do_allocate(std::size_t bytes, std::size_t align) override
+  {
+    ++allocations;
+    this->bytes += bytes;
+    return upstream_->allocate(bytes, align);
+  }
+  void do_deallocate(void* p, std::size_t bytes, std::size_t align) override { upstream_->deallocate(p, bytes, align); }
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+using allocator = std::pmr::polymorphic_allocator<>;
+
+generator<int> keys(std::allocator_arg_t, allocator, int first, int count)
+{
+  for(int i = first; i < first + count; ++i)
+    co_yield i;
+}
+
+task<int> lookup(std::allocator_arg_t, allocator, int key)
+{
+  co_return key * 2;
+}
+
+task<int> handle_request(std::allocator_arg_t, allocator alloc, int id)
+{
+  int sum = 0;
+  auto g = keys(std::allocator_arg, alloc, id, 10);
+  while(g.next())
+    sum += co_await lookup(std::allocator_arg, alloc, g.value());
+  co_return sum;
+}
+
+// no allocator argument: the frame comes from `new_delete_resource()`
+task<int> foo()
+{
+  co_return 42;
+}
+
+int main()
+{
+  const auto f = foo();
+  f.start();
+  std::cout << "foo: " << f.get_result() << "\n";
+
+  alignas(std::max_align_t) std::array<std::byte, 16 * 1024> buffer;
+  std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+  counting_resource counter(&arena);
+
+  for(int request = 0; request < 3; ++request) {
+    {
+      const auto t = handle_request(std::allocator_arg, &counter, request * 100);
+      t.start();
+      std::cout << "request " << request << ": " << t.get_result();
+    }
+    std::cout << ", " << counter.allocations << " frames, " << counter.bytes << " bytes in the arena\n";
+    // the whole request is gone, drop all its frames at once
+    arena.release();
+    counter.allocations = counter.bytes = 0;
+  }
+}
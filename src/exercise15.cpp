@@ -0,0 +1,187 @@
+// - Make `generator<T>` zero-copy
+//   - `yield_value()` stores a pointer to the yielded object instead of copying it
+//     - the object (or the temporary bound by `co_yield`) lives in the suspended frame until the
+//       generator is resumed again
+//   - `generator<T>` yields `const T&`, `generator<T&>` yields `T&`, `generator<T&&>` yields `T&&`
+// - Provide `begin()`/`end()` so that the generator models `std::ranges::input_range`
+//   - the generator is a move-only view, so it can feed `std::views` pipelines directly
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <ranges>
+#include <type_traits>
+#include <utility>
+
+
+// ********* RAII *********
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* GENERATOR *********
+
+template<typename T>
+class [[nodiscard]] generator : public std::ranges::view_interface<generator<T>> {
+public:
+  using value_type = std::remove_cvref_t<T>;
+  using reference = std::conditional_t<std::is_reference_v<T>, T, const T&>;
+
+  struct promise_type {
+    std::add_pointer_t<reference> value = nullptr;
+
+    generator get_return_object() noexcept { return this; }
+    auto await_transform(auto) = delete;
+    void unhandled_exception() { throw; }
+    void return_void() noexcept {}
+
+    std::suspend_always initial_suspend() noexcept { return {}; };
+    std::suspend_always final_suspend() noexcept { return {}; }
+
+    // the yielded object outlives the suspension, so its address is all we need
+    std::suspend_always yield_value(reference expr) noexcept {
+      value = std::addressof(expr);
+      return {};
+    }
+  };
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  class iterator {
+  public:
+    using value_type = generator::value_type;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    iterator(iterator&&) = default;
+    iterator& operator=(iterator&&) = default;
+
+    reference operator*() const noexcept { return static_cast<reference>(*handle_.promise().value); }
+
+    iterator& operator++()
+    {
+      handle_.resume();
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    friend bool operator==(const iterator& it, std::default_sentinel_t) noexcept { return it.handle_.done(); }
+
+  private:
+    friend generator;
+    explicit iterator(handle_type h) noexcept : handle_(h) {}
+    handle_type handle_;
+  };
+
+  generator(generator&&) noexcept = default;
+  generator& operator=(generator&&) noexcept = default;
+
+  // resumes the coroutine up to its first `co_yield`; may be called only once
+  iterator begin()
+  {
+    auto handle = handle_type::from_promise(*promise_);
+    handle.resume();
+    return iterator(handle);
+  }
+  static std::default_sentinel_t end() noexcept { return {}; }
+
+  bool next() {
+    auto handle = handle_type::from_promise(*promise_);
+    handle.resume();
+    return !handle.done();
+  }
+
+  reference value() const noexcept {
+    return static_cast<reference>(*promise_->value);
+  }
+
+private:
+  generator(promise_type* p) noexcept : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+static_assert(std::ranges::input_range<generator<int>>);
+static_assert(std::ranges::view<generator<int>>);
+
+
+// ********* EXAMPLE *********
+
+#include <array>
+#include <iostream>
+
+generator<int> simple()
+{
+  // co_await std::suspend_never{}; // should not compile
+  co_yield 1;
+  co_yield 2;
+}
+
+// a big record that counts its copies
+struct record {
+  inline static int copies = 0;
+
+  int id;
+  std::array<char, 4096> payload{};
+
+  explicit record(int i) : id(i) {}
+  record(const record& other) : id(other.id), payload(other.payload) { ++copies; }
+  record& operator=(const record& other)
+  {
+    id = other.id;
+    payload = other.payload;
+    ++copies;
+    return *this;
+  }
+};
+
+generator<record> records(int count)
+{
+  record r(0);
+  for(int i = 0; i < count; ++i) {
+    r.id = i;
+    co_yield r;
+  }
+}
+
+generator<record&> mutable_records(int count)
+{
+  record r(0);
+  for(int i = 0; i < count; ++i) {
+    r.id = i;
+    co_yield r;
+    std::cout << "consumer wrote " << r.payload[0] << "\n";
+  }
+}
+
+int main()
+{
+  auto g = simple();
+  while (g.next())
+    std::cout << g.value() << ' ';
+  std::cout << '\n';
+
+  for(int v : simple())
+    std::cout << v << ' ';
+  std::cout << '\n';
+
+  auto odd_ids = records(10)
+                 | std::views::filter([](const record& r) { return r.id % 2; })
+                 | std::views::transform(&record::id);
+  for(int id : odd_ids)
+    std::cout << id << ' ';
+  std::cout << "\ncopies of records: " << record::copies << "\n";
+
+  for(record& r : mutable_records(2))
+    r.payload[0] = static_cast<char>('a' + r.id);
+}
@@ -0,0 +1,243 @@
+// - Make `generator<T>` recursive
+//   - `co_yield elements_of(child)` yields all elements of a nested generator
+//   - the consumer resumes the innermost active generator directly, so the cost per element does
+//     not depend on the nesting depth
+//     - every promise knows the root, the root knows the current leaf
+//     - entering and leaving a nested generator is a symmetric transfer
+//   - exceptions thrown by a nested generator are rethrown at its `co_yield elements_of(...)`
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <ranges>
+#include <type_traits>
+#include <utility>
+
+
+// ********* RAII *********
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* GENERATOR *********
+
+template<std::ranges::range R>
+struct elements_of {
+  R range;
+};
+
+template<typename R>
+elements_of(R&&) -> elements_of<R&&>;
+
+template<typename T>
+class [[nodiscard]] generator : public std::ranges::view_interface<generator<T>> {
+public:
+  using value_type = std::remove_cvref_t<T>;
+  using reference = std::conditional_t<std::is_reference_v<T>, T, const T&>;
+
+  struct promise_type {
+    std::add_pointer_t<reference> value = nullptr;
+    promise_type* root = this;
+    promise_type* leaf = this;    // meaningful only in the root
+    promise_type* parent = nullptr;
+    std::exception_ptr exception; // set only in nested generators
+
+    generator get_return_object() noexcept { return this; }
+    auto await_transform(auto) = delete;
+    void unhandled_exception()
+    {
+      if(root == this) throw;
+      exception = std::current_exception();
+    }
+    void return_void() noexcept {}
+
+    std::suspend_always initial_suspend() noexcept { return {}; };
+    auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          promise_type& p = h.promise();
+          if(!p.parent) return std::noop_coroutine();
+          p.root->leaf = p.parent;
+          return handle_type::from_promise(*p.parent);
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+
+    std::suspend_always yield_value(reference expr) noexcept {
+      root->value = std::addressof(expr);
+      return {};
+    }
+
+    auto yield_value(elements_of<generator> nested) noexcept
+    {
+      struct awaiter {
+        generator child;
+        static bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(handle_type h) noexcept
+        {
+          promise_type& parent = h.promise();
+          promise_type& p = *child.promise_;
+          p.root = parent.root;
+          p.parent = &parent;
+          parent.root->leaf = &p;
+          return handle_type::from_promise(p);
+        }
+        void await_resume() const
+        {
+          if(child.promise_->exception) std::rethrow_exception(child.promise_->exception);
+        }
+      };
+      return awaiter{std::move(nested.range)};
+    }
+    auto yield_value(elements_of<generator&&> nested) noexcept
+    {
+      return yield_value(elements_of<generator>{std::move(nested.range)});
+    }
+  };
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  class iterator {
+  public:
+    using value_type = generator::value_type;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    iterator(iterator&&) = default;
+    iterator& operator=(iterator&&) = default;
+
+    reference operator*() const noexcept { return static_cast<reference>(*root_.promise().value); }
+
+    iterator& operator++()
+    {
+      handle_type::from_promise(*root_.promise().leaf).resume();
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    friend bool operator==(const iterator& it, std::default_sentinel_t) noexcept { return it.root_.done(); }
+
+  private:
+    friend generator;
+    explicit iterator(handle_type h) noexcept : root_(h) {}
+    handle_type root_;
+  };
+
+  generator(generator&&) noexcept = default;
+  generator& operator=(generator&&) noexcept = default;
+
+  // resumes the coroutine up to its first `co_yield`; may be called only once
+  iterator begin()
+  {
+    auto handle = handle_type::from_promise(*promise_);
+    handle.resume();
+    return iterator(handle);
+  }
+  static std::default_sentinel_t end() noexcept { return {}; }
+
+private:
+  generator(promise_type* p) noexcept : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+static_assert(std::ranges::input_range<generator<int>>);
+static_assert(std::ranges::view<generator<int>>);
+
+
+// ********* EXAMPLE *********
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+generator<int> inner()
+{
+  co_yield 2;
+  co_yield 3;
+}
+
+generator<int> outer()
+{
+  co_yield 1;
+  co_yield elements_of(inner());
+  co_yield 4;
+}
+
+generator<int> failing()
+{
+  co_yield 1;
+  throw std::runtime_error("nested failure");
+}
+
+generator<int> recovering()
+{
+  try {
+    co_yield elements_of(failing());
+  }
+  catch(const std::exception& ex) {
+    std::cout << "(caught: " << ex.what() << ") ";
+  }
+  co_yield 2;
+}
+
+// in-order walk of an implicit complete binary tree: node `i` has children `2i+1` and `2i+2`
+generator<int> walk_recursive(int node, int size)
+{
+  if(node >= size) co_return;
+  co_yield elements_of(walk_recursive(2 * node + 1, size));
+  co_yield node;
+  co_yield elements_of(walk_recursive(2 * node + 2, size));
+}
+
+// the same walk re-yielding every element through every level
+generator<int> walk_reyield(int node, int size)
+{
+  if(node >= size) co_return;
+  for(int v : walk_reyield(2 * node + 1, size)) co_yield v;
+  co_yield node;
+  for(int v : walk_reyield(2 * node + 2, size)) co_yield v;
+}
+
+template<typename Walk>
+double ns_per_element(Walk walk, int size)
+{
+  long sum = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for(int v : walk(0, size)) sum += v;
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  if(sum != static_cast<long>(size) * (size - 1) / 2) std::terminate();
+  return std::chrono::duration<double, std::nano>(elapsed).count() / size;
+}
+
+int main()
+{
+  for(int v : outer())
+    std::cout << v << ' ';
+  std::cout << '\n';
+
+  for(int v : recovering())
+    std::cout << v << ' ';
+  std::cout << '\n';
+
+  for(int depth = 8; depth <= 20; depth += 4) {
+    const int size = (1 << depth) - 1;
+    std::cout << "depth " << depth << ": elements_of " << ns_per_element(walk_recursive, size)
+              << " ns/element, re-yield " << ns_per_element(walk_reyield, size) << " ns/element\n";
+  }
+}
@@ -0,0 +1,212 @@
+// - Implement `chunked_generator<T, N>` that hands out values in batches
+//   - `co_yield value` appends to a fixed-capacity buffer in the promise and suspends only when
+//     the buffer is full
+//   - whatever is left in the buffer is handed out after the coroutine finishes
+//   - the consumer iterates over `std::span<const T>` batches, loops over a batch can be vectorized
+// - `elements()` flattens the batches back into an element range
+//   - the coroutine is resumed once per batch instead of once per element
+
+#include <array>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <ranges>
+#include <span>
+#include <utility>
+
+
+// ********* RAII *********
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* CHUNKED GENERATOR *********
+
+template<std::default_initializable T, std::size_t N>
+  requires(N > 0)
+class [[nodiscard]] chunked_generator {
+public:
+  struct promise_type {
+    std::array<T, N> buffer;
+    std::size_t size = 0;
+
+    chunked_generator get_return_object() noexcept { return this; }
+    auto await_transform(auto) = delete;
+    void unhandled_exception() { throw; }
+    void return_void() noexcept {}
+
+    std::suspend_always initial_suspend() noexcept { return {}; };
+    std::suspend_always final_suspend() noexcept { return {}; }
+
+    template<std::convertible_to<T> U>
+    auto yield_value(U&& value) noexcept(std::is_nothrow_assignable_v<T&, U&&>)
+    {
+      // counted only once assigned, a throwing assignment exposes no element
+      buffer[size] = std::forward<U>(value);
+      ++size;
+      struct awaiter {
+        bool full;
+        bool await_ready() const noexcept { return !full; }
+        static void await_suspend(std::coroutine_handle<>) noexcept {}
+        static void await_resume() noexcept {}
+      };
+      return awaiter{size == N};
+    }
+  };
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  // returns the next batch or an empty span when the generator is exhausted
+  std::span<const T> next_batch()
+  {
+    promise_type& p = *promise_;
+    p.size = 0;
+    auto handle = handle_type::from_promise(p);
+    if(!handle.done()) handle.resume();
+    return {p.buffer.data(), p.size};
+  }
+
+  class batch_iterator {
+  public:
+    using value_type = std::span<const T>;
+    using difference_type = std::ptrdiff_t;
+
+    batch_iterator() = default;
+
+    value_type operator*() const noexcept { return batch_; }
+    batch_iterator& operator++()
+    {
+      batch_ = gen_->next_batch();
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    friend bool operator==(const batch_iterator& it, std::default_sentinel_t) noexcept { return it.batch_.empty(); }
+
+  private:
+    friend chunked_generator;
+    explicit batch_iterator(chunked_generator& g) : gen_(&g), batch_(g.next_batch()) {}
+    chunked_generator* gen_ = nullptr;
+    value_type batch_;
+  };
+
+  class element_iterator {
+  public:
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+
+    element_iterator() = default;
+
+    const T& operator*() const noexcept { return batch_[index_]; }
+    element_iterator& operator++()
+    {
+      // the coroutine is resumed only at the end of a batch
+      if(++index_ == batch_.size()) {
+        batch_ = gen_->next_batch();
+        index_ = 0;
+      }
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    friend bool operator==(const element_iterator& it, std::default_sentinel_t) noexcept { return it.batch_.empty(); }
+
+  private:
+    friend chunked_generator;
+    explicit element_iterator(chunked_generator& g) : gen_(&g), batch_(g.next_batch()) {}
+    chunked_generator* gen_ = nullptr;
+    std::span<const T> batch_;
+    std::size_t index_ = 0;
+  };
+
+  // iterates over batches; may be called only once
+  batch_iterator begin() { return batch_iterator(*this); }
+  static std::default_sentinel_t end() noexcept { return {}; }
+
+  class element_view : public std::ranges::view_interface<element_view> {
+  public:
+    explicit element_view(chunked_generator&& g) noexcept : gen_(std::move(g)) {}
+    element_iterator begin() { return element_iterator(gen_); }
+    static std::default_sentinel_t end() noexcept { return {}; }
+  private:
+    chunked_generator gen_;
+  };
+
+  // iterates over elements; may be called only once
+  auto elements() & { return std::ranges::subrange(element_iterator(*this), std::default_sentinel); }
+  element_view elements() && { return element_view(std::move(*this)); }
+
+  chunked_generator(chunked_generator&&) noexcept = default;
+  chunked_generator& operator=(chunked_generator&&) noexcept = default;
+
+private:
+  chunked_generator(promise_type* p) noexcept : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <chrono>
+#include <iostream>
+#include <numeric>
+
+template<std::size_t N>
+chunked_generator<int, N> iota(int count)
+{
+  for(int i = 0; i < count; ++i)
+    co_yield i;
+}
+
+template<typename F>
+void benchmark(const char* name, int count, F&& consume)
+{
+  const auto start = std::chrono::steady_clock::now();
+  const long sum = consume();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << name << ": " << std::chrono::duration<double, std::nano>(elapsed).count() / count
+            << " ns/element (sum " << sum << ")\n";
+}
+
+int main()
+{
+  for(std::span<const int> batch : iota<4>(10)) {
+    std::cout << "[ ";
+    for(int v : batch) std::cout << v << ' ';
+    std::cout << "] ";
+  }
+  std::cout << '\n';
+
+  for(int v : iota<4>(10).elements())
+    std::cout << v << ' ';
+  std::cout << '\n';
+
+  constexpr int count = 10'000'000;
+  benchmark("per-element resume", count, [] {
+    long sum = 0;
+    for(std::span<const int> batch : iota<1>(count)) sum += batch[0];
+    return sum;
+  });
+  benchmark("batches of 256    ", count, [] {
+    long sum = 0;
+    for(std::span<const int> batch : iota<256>(count)) sum = std::accumulate(batch.begin(), batch.end(), sum);
+    return sum;
+  });
+  benchmark("flattened batches ", count, [] {
+    long sum = 0;
+    for(int v : iota<256>(count).elements()) sum += v;
+    return sum;
+  });
+}
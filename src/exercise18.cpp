@@ -0,0 +1,333 @@
+// - Implement `async_generator<T>`: a generator that may also `co_await`
+//   - the consumer drives it with `co_await gen.next()` from inside a coroutine
+//     - returns a pointer to the next value or `nullptr` when the generator is exhausted
+//   - the producer may `co_await` timers or other tasks between its `co_yield`s
+//   - control moves between the consumer and the producer by symmetric transfer
+//   - values are not copied, only one value is alive at a time
+// - Exceptions thrown by the producer are rethrown from `co_await gen.next()`
+
+#include <chrono>
+#include <concepts>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return *result;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+  };
+
+  void start() const
+  {
+    std::coroutine_handle<promise_type>::from_promise(*promise_).resume();
+  }
+
+  [[nodiscard]] decltype(auto) get_result() const &
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() const &&
+  {
+    return std::move(promise_)->get();
+  }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      bool await_ready() const noexcept
+      {
+        return std::coroutine_handle<promise_type>::from_promise(*p_).done();
+      }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        p_->continuation = caller;
+        return std::coroutine_handle<promise_type>::from_promise(*p_);
+      }
+      decltype(auto) await_resume() const { return std::move(*p_).get(); }
+    };
+    return awaiter{promise_.get()};
+  }
+
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* ASYNC GENERATOR *********
+
+template<typename T>
+class [[nodiscard]] async_generator {
+public:
+  using value_type = std::remove_cvref_t<T>;
+  using reference = std::conditional_t<std::is_reference_v<T>, T, const T&>;
+  using pointer = std::add_pointer_t<reference>;
+
+  struct promise_type {
+    pointer value = nullptr;
+    std::coroutine_handle<> consumer = std::noop_coroutine();
+    std::exception_ptr exception;
+
+    async_generator get_return_object() noexcept { return this; }
+    void unhandled_exception() noexcept { exception = std::current_exception(); }
+    void return_void() noexcept {}
+
+    // hands control back to the consumer waiting in `next()`
+    struct to_consumer {
+      static bool await_ready() noexcept { return false; }
+      static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+      {
+        return h.promise().consumer;
+      }
+      static void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    to_consumer final_suspend() noexcept
+    {
+      value = nullptr;
+      return {};
+    }
+
+    to_consumer yield_value(reference expr) noexcept
+    {
+      value = std::addressof(expr);
+      return {};
+    }
+  };
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  async_generator(async_generator&&) noexcept = default;
+  async_generator& operator=(async_generator&&) noexcept = default;
+
+  // resumes the producer until its next `co_yield` or its end
+  [[nodiscard]] auto next() noexcept
+  {
+    struct awaiter {
+      promise_type& p;
+      bool await_ready() const noexcept { return handle_type::from_promise(p).done(); }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) const noexcept
+      {
+        p.consumer = consumer;
+        return handle_type::from_promise(p);
+      }
+      pointer await_resume() const
+      {
+        if(p.exception) std::rethrow_exception(std::exchange(p.exception, nullptr));
+        return p.value;
+      }
+    };
+    return awaiter{*promise_};
+  }
+
+private:
+  async_generator(promise_type* p) noexcept : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* EVENT LOOP *********
+
+// single-threaded loop resuming coroutines when their timers expire
+class event_loop {
+public:
+  using clock = std::chrono::steady_clock;
+
+  template<typename Rep, typename Period>
+  [[nodiscard]] auto sleep_for(std::chrono::duration<Rep, Period> d)
+  {
+    struct awaiter {
+      event_loop& loop;
+      clock::time_point deadline;
+      static bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) const { loop.timers_.push({deadline, h}); }
+      static void await_resume() noexcept {}
+    };
+    return awaiter{*this, clock::now() + d};
+  }
+
+  void run()
+  {
+    while(!timers_.empty()) {
+      const auto t = timers_.top();
+      timers_.pop();
+      std::this_thread::sleep_until(t.deadline);
+      t.handle.resume();
+    }
+  }
+
+private:
+  struct timer {
+    clock::time_point deadline;
+    std::coroutine_handle<> handle;
+    bool operator>(const timer& other) const noexcept { return deadline > other.deadline; }
+  };
+  std::priority_queue<timer, std::vector<timer>, std::greater<>> timers_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <iostream>
+#include <stdexcept>
+
+using namespace std::chrono_literals;
+
+task<int> fetch(event_loop& loop, int key)
+{
+  co_await loop.sleep_for(5ms);
+  co_return key * key;
+}
+
+// streams the results one by one instead of materializing all of them
+async_generator<int> squares(event_loop& loop, int count)
+{
+  for(int i = 0; i < count; ++i)
+    co_yield co_await fetch(loop, i);
+}
+
+async_generator<int> failing(event_loop& loop)
+{
+  co_await loop.sleep_for(1ms);
+  co_yield 1;
+  throw std::runtime_error("producer failed");
+}
+
+task<void> consume(event_loop& loop)
+{
+  auto g = squares(loop, 5);
+  while(const int* v = co_await g.next())
+    std::cout << *v << ' ';
+  std::cout << '\n';
+
+  try {
+    auto f = failing(loop);
+    while(const int* v = co_await f.next())
+      std::cout << *v << ' ';
+  }
+  catch(const std::exception& ex) {
+    std::cout << "caught: " << ex.what() << '\n';
+  }
+}
+
+int main()
+{
+  event_loop loop;
+  const auto t = consume(loop);
+  t.start();
+  loop.run();
+  t.get_result();
+}
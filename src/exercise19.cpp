@@ -0,0 +1,282 @@
+// - Implement a coroutine return type `future<T>` that does not need a separate shared state
+//   - the coroutine frame is the shared state: it holds the result and an atomic state word
+//   - `get()` blocks with `std::atomic::wait` until the result is ready
+//   - the frame is destroyed by whoever is last: the finished coroutine or the `future`
+//     - the state word keeps a reference count next to the "ready" bit
+// - Compare it with the `std::future` coroutine from exercise 1
+
+#include <atomic>
+#include <concepts>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <utility>
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return *result;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+template<typename T>
+struct future_promise_storage : storage<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct future_promise_storage<void> : storage<void> {
+  void return_void() noexcept {}
+};
+
+}
+
+
+// ********* FUTURE *********
+
+template<typename T>
+concept future_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<future_value_type T>
+class [[nodiscard]] future {
+  // bit 0 - result is ready, the rest - number of owners of the frame (coroutine and future)
+  static constexpr std::uint32_t ready = 1;
+  static constexpr std::uint32_t owner = 2;
+
+public:
+  struct promise_type : detail::future_promise_storage<T> {
+    std::atomic<std::uint32_t> state{2 * owner};
+
+    future get_return_object() noexcept { return future(this); }
+    static std::suspend_never initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static void await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          promise_type& p = h.promise();
+          p.state.fetch_or(ready, std::memory_order_release);
+          p.state.notify_all();
+          p.release();
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+
+    void release() noexcept
+    {
+      if(state.fetch_sub(owner, std::memory_order_acq_rel) / owner == 1)
+        std::coroutine_handle<promise_type>::from_promise(*this).destroy();
+    }
+  };
+
+  future(future&& other) noexcept : promise_(std::exchange(other.promise_, nullptr)) {}
+  future& operator=(future&& other) noexcept
+  {
+    if(this != &other) {
+      if(promise_) promise_->release();
+      promise_ = std::exchange(other.promise_, nullptr);
+    }
+    return *this;
+  }
+  ~future()
+  {
+    if(promise_) promise_->release();
+  }
+
+  [[nodiscard]] bool is_ready() const noexcept { return promise_->state.load(std::memory_order_acquire) & ready; }
+
+  void wait() const noexcept
+  {
+    auto s = promise_->state.load(std::memory_order_acquire);
+    while(!(s & ready)) {
+      promise_->state.wait(s, std::memory_order_acquire);
+      s = promise_->state.load(std::memory_order_acquire);
+    }
+  }
+
+  // blocks until the coroutine finishes; may be called only once
+  decltype(auto) get()
+  {
+    wait();
+    if constexpr(std::is_void_v<T>)
+      return promise_->get();
+    else
+      return T(std::move(*promise_).get());
+  }
+
+private:
+  explicit future(promise_type* p) noexcept : promise_(p) {}
+  promise_type* promise_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+// count calls to the global allocator, from every thread
+inline std::atomic<std::size_t> global_allocations = 0;
+inline std::atomic<std::size_t> global_deallocations = 0;
+
+// not inlined: GCC would pair the `malloc()` inside with the counting `operator delete` and warn
+// about a mismatch
+[[gnu::noinline]] void* operator new(std::size_t size)
+{
+  global_allocations.fetch_add(1, std::memory_order_relaxed);
+  if(void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept
+{
+  if(p) global_deallocations.fetch_add(1, std::memory_order_relaxed);
+  std::free(p);
+}
+void operator delete(void* p, std::size_t) noexcept { operator delete(p); }
+
+// the exercise 1 approach
+template<typename R, typename... Args>
+struct std::coroutine_traits<std::future<R>, Args...> {
+  struct promise_type {
+    std::promise<R> p;
+    auto initial_suspend() { return std::suspend_never{}; }
+    auto final_suspend() noexcept { return std::suspend_never{}; }
+    void return_value(R v) { p.set_value(v); }
+    auto get_return_object() { return p.get_future(); }
+    void unhandled_exception() { p.set_exception(std::current_exception()); }
+  };
+};
+
+std::future<int> std_foo()
+{
+  co_return 42;
+}
+
+future<int> foo()
+{
+  co_return 42;
+}
+
+future<void> fail()
+{
+  throw std::runtime_error("failed");
+  co_return;
+}
+
+// finishes on another thread while `get()` is blocked
+future<int> on_thread(std::jthread& t)
+{
+  struct switch_thread {
+    std::jthread& t;
+    static bool await_ready() noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) const
+    {
+      t = std::jthread([h] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        h.resume();
+      });
+    }
+    static void await_resume() noexcept {}
+  };
+  co_await switch_thread{t};
+  co_return 23;
+}
+
+template<typename F>
+void benchmark(const char* name, F coro)
+{
+  constexpr int iterations = 1'000'000;
+  long sum = 0;
+  const auto allocs_before = global_allocations.load();
+  const auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < iterations; ++i) sum += coro().get();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << name << ": " << std::chrono::duration<double, std::nano>(elapsed).count() / iterations << " ns/call, "
+            << static_cast<double>(global_allocations - allocs_before) / iterations << " allocations/call (checksum "
+            << sum << ")\n";
+}
+
+int main()
+{
+  std::cout << foo().get() << "\n";
+
+  try {
+    fail().get();
+  }
+  catch(const std::exception& ex) {
+    std::cout << "caught: " << ex.what() << "\n";
+  }
+
+  {
+    std::jthread t;
+    auto f = on_thread(t);
+    std::cout << "ready before get(): " << f.is_ready() << ", result: " << f.get() << "\n";
+  }
+
+  // a future dropped before the coroutine finishes does not leak the frame
+  {
+    const auto live_before = global_allocations.load() - global_deallocations.load();
+    {
+      std::jthread t;
+      auto f = on_thread(t);
+    }
+    std::cout << "allocations leaked by a dropped future: " << global_allocations - global_deallocations - live_before
+              << "\n";
+  }
+
+  benchmark("std::future", std_foo);
+  benchmark("future     ", foo);
+}
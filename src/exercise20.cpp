@@ -0,0 +1,480 @@
+// - Implement `when_all()` and `when_any()` to await several tasks concurrently
+//   - `when_all(tasks...)` returns a `std::tuple` of results, `when_all(std::vector<task<T>>)`
+//     a `std::vector` of results
+//     - `void` results are represented as `std::monostate`
+//   - `when_any(tasks...)` returns a `std::variant` whose index tells which task finished first,
+//     `when_any(std::vector<task<T>>)` returns the index and the value, an empty vector throws
+//     `std::invalid_argument` when awaited, as no task can ever win
+//     - the remaining tasks are cancelled by destroying their frames before `when_any()` returns,
+//       so they must be suspended at that point (e.g. all tasks run on one event loop)
+// - All children are started at once and report to an atomic countdown latch
+//   - the latch lives in the combinator frame, the children's final suspend points arrive at it
+//   - no allocation beyond the children's frames and the combinator's own frame
+
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <variant>
+#include <vector>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* LATCH *********
+
+namespace detail {
+
+// Counts down the completions of the children plus one for the awaiting coroutine itself, so
+// that whoever arrives last resumes the awaiting coroutine.  In "any" mode only the first child
+// to finish counts.
+class completion_latch {
+public:
+  static constexpr std::size_t no_winner = std::numeric_limits<std::size_t>::max();
+
+  completion_latch(std::size_t children, bool any) noexcept : count_(any ? 2 : children + 1), any_(any) {}
+
+  [[nodiscard]] std::coroutine_handle<> arrive(std::size_t index) noexcept
+  {
+    if(any_) {
+      auto expected = no_winner;
+      if(!winner_.compare_exchange_strong(expected, index, std::memory_order_acq_rel))
+        return std::noop_coroutine();
+    }
+    return count_.fetch_sub(1, std::memory_order_acq_rel) == 1 ? awaiting_ : std::noop_coroutine();
+  }
+
+  // called by the awaiting coroutine after all children were started; returns whether it should suspend
+  [[nodiscard]] bool try_await(std::coroutine_handle<> awaiting) noexcept
+  {
+    awaiting_ = awaiting;
+    return count_.fetch_sub(1, std::memory_order_acq_rel) != 1;
+  }
+
+  [[nodiscard]] std::size_t winner() const noexcept { return winner_.load(std::memory_order_acquire); }
+
+private:
+  std::atomic<std::size_t> count_;
+  std::atomic<std::size_t> winner_{no_winner};
+  bool any_;
+  std::coroutine_handle<> awaiting_;
+};
+
+}
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return *result;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    // set instead of `continuation` when started by a combinator
+    detail::completion_latch* latch = nullptr;
+    std::size_t index = 0;
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          promise_type& p = h.promise();
+          return p.latch ? p.latch->arrive(p.index) : p.continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+  };
+
+  void start() const
+  {
+    std::coroutine_handle<promise_type>::from_promise(*promise_).resume();
+  }
+
+  // starts the task as a child of a combinator, its completion arrives at `latch`
+  void start(detail::completion_latch& latch, std::size_t index) const
+  {
+    promise_->latch = &latch;
+    promise_->index = index;
+    start();
+  }
+
+  [[nodiscard]] decltype(auto) get_result() const &
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() const &&
+  {
+    return std::move(promise_)->get();
+  }
+  [[nodiscard]] decltype(auto) take_result()
+  {
+    return std::move(*promise_).get();
+  }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      bool await_ready() const noexcept
+      {
+        return std::coroutine_handle<promise_type>::from_promise(*p_).done();
+      }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        p_->continuation = caller;
+        return std::coroutine_handle<promise_type>::from_promise(*p_);
+      }
+      decltype(auto) await_resume() const { return std::move(*p_).get(); }
+    };
+    return awaiter{promise_.get()};
+  }
+
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* COMBINATORS *********
+
+template<typename T>
+using non_void_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+namespace detail {
+
+template<typename T>
+non_void_t<T> take_result(task<T>& t)
+{
+  if constexpr(std::is_void_v<T>) {
+    t.take_result();
+    return {};
+  }
+  else
+    return T(t.take_result());
+}
+
+// starts all children in `await_suspend()` and resumes the awaiting coroutine through the latch
+template<typename StartAll>
+struct latch_awaiter {
+  completion_latch latch;
+  StartAll start_all;
+
+  static bool await_ready() noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> awaiting) noexcept
+  {
+    start_all(latch);
+    return latch.try_await(awaiting);
+  }
+  static void await_resume() noexcept {}
+};
+
+template<typename StartAll>
+latch_awaiter<StartAll> make_latch_awaiter(std::size_t children, bool any, StartAll start_all)
+{
+  return {completion_latch(children, any), std::move(start_all)};
+}
+
+}
+
+template<typename... Ts>
+task<std::tuple<non_void_t<Ts>...>> when_all(task<Ts>... tasks)
+{
+  co_await detail::make_latch_awaiter(sizeof...(Ts), false, [&](detail::completion_latch& latch) {
+    std::size_t index = 0;
+    (tasks.start(latch, index++), ...);
+  });
+  co_return std::tuple<non_void_t<Ts>...>(detail::take_result(tasks)...);
+}
+
+template<typename T>
+task<std::vector<non_void_t<T>>> when_all(std::vector<task<T>> tasks)
+{
+  co_await detail::make_latch_awaiter(tasks.size(), false, [&](detail::completion_latch& latch) {
+    for(std::size_t i = 0; i < tasks.size(); ++i) tasks[i].start(latch, i);
+  });
+  std::vector<non_void_t<T>> results;
+  results.reserve(tasks.size());
+  for(auto& t : tasks) results.push_back(detail::take_result(t));
+  co_return results;
+}
+
+template<typename... Ts>
+task<std::variant<non_void_t<Ts>...>> when_any(task<Ts>... tasks)
+{
+  using result_type = std::variant<non_void_t<Ts>...>;
+  std::optional<result_type> result;
+  {
+    // the losers are destroyed at the end of this scope
+    std::tuple<task<Ts>...> children(std::move(tasks)...);
+    auto awaiter = detail::make_latch_awaiter(sizeof...(Ts), true, [&](detail::completion_latch& latch) {
+      std::apply([&](auto&... t) {
+        std::size_t index = 0;
+        (t.start(latch, index++), ...);
+      }, children);
+    });
+    co_await awaiter;
+    const auto winner = awaiter.latch.winner();
+    [&]<std::size_t... I>(std::index_sequence<I...>) {
+      ((I == winner ? (result.emplace(std::in_place_index<I>, detail::take_result(std::get<I>(children))), 0) : 0), ...);
+    }(std::index_sequence_for<Ts...>{});
+  }
+  co_return std::move(*result);
+}
+
+template<typename T>
+struct when_any_result {
+  std::size_t index;
+  non_void_t<T> value;
+};
+
+template<typename T>
+task<when_any_result<T>> when_any(std::vector<task<T>> tasks)
+{
+  if(tasks.empty()) throw std::invalid_argument("when_any() of no tasks");
+  auto awaiter = detail::make_latch_awaiter(tasks.size(), true, [&](detail::completion_latch& latch) {
+    for(std::size_t i = 0; i < tasks.size(); ++i) tasks[i].start(latch, i);
+  });
+  co_await awaiter;
+  const auto winner = awaiter.latch.winner();
+  when_any_result<T> result{winner, detail::take_result(tasks[winner])};
+  tasks.clear();
+  co_return result;
+}
+
+
+// ********* EVENT LOOP *********
+
+// single-threaded loop resuming coroutines when their timers expire; destroying a suspended
+// coroutine removes its timer
+class event_loop {
+public:
+  using clock = std::chrono::steady_clock;
+
+  template<typename Rep, typename Period>
+  [[nodiscard]] auto sleep_for(std::chrono::duration<Rep, Period> d)
+  {
+    struct awaiter {
+      event_loop& loop;
+      clock::time_point deadline;
+      std::optional<timer_map::iterator> timer{};
+
+      awaiter(event_loop& l, clock::time_point dl) : loop(l), deadline(dl) {}
+      awaiter(const awaiter&) = delete;
+      awaiter& operator=(const awaiter&) = delete;
+      ~awaiter()
+      {
+        if(timer) loop.timers_.erase(*timer);
+      }
+
+      static bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) { timer = loop.timers_.emplace(deadline, timer_entry{h, &timer}); }
+      static void await_resume() noexcept {}
+    };
+    return awaiter(*this, clock::now() + d);
+  }
+
+  [[nodiscard]] std::size_t pending_timers() const noexcept { return timers_.size(); }
+
+  void run()
+  {
+    while(!timers_.empty()) {
+      auto it = timers_.begin();
+      std::this_thread::sleep_until(it->first);
+      const auto h = it->second.handle;
+      it->second.registration->reset();
+      timers_.erase(it);
+      h.resume();
+    }
+  }
+
+private:
+  struct timer_entry;
+  using timer_map = std::multimap<clock::time_point, timer_entry>;
+  struct timer_entry {
+    std::coroutine_handle<> handle;
+    std::optional<timer_map::iterator>* registration;
+  };
+  timer_map timers_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <iostream>
+#include <string>
+
+using namespace std::chrono_literals;
+using ms = std::chrono::milliseconds;
+
+task<int> lookup(event_loop& loop, int key, ms latency)
+{
+  co_await loop.sleep_for(latency);
+  co_return key * 10;
+}
+
+task<std::string> name(event_loop& loop, ms latency)
+{
+  co_await loop.sleep_for(latency);
+  co_return "fast";
+}
+
+task<void> log(event_loop& loop, ms latency)
+{
+  co_await loop.sleep_for(latency);
+}
+
+template<typename F>
+void timed(const char* name, event_loop& loop, F coro)
+{
+  const auto start = event_loop::clock::now();
+  const auto t = coro();
+  t.start();
+  loop.run();
+  const auto elapsed = std::chrono::duration_cast<ms>(event_loop::clock::now() - start);
+  std::cout << name << ": " << elapsed.count() << "ms\n";
+}
+
+int main()
+{
+  event_loop loop;
+
+  timed("sequential", loop, [&]() -> task<void> {
+    const int a = co_await lookup(loop, 1, 30ms);
+    const int b = co_await lookup(loop, 2, 20ms);
+    const int c = co_await lookup(loop, 3, 10ms);
+    std::cout << a + b + c << " ";
+  });
+
+  timed("when_all  ", loop, [&]() -> task<void> {
+    const auto [a, b, c] = co_await when_all(lookup(loop, 1, 30ms), name(loop, 20ms), log(loop, 10ms));
+    std::cout << a << " " << b << " ";
+  });
+
+  timed("when_all  ", loop, [&]() -> task<void> {
+    std::vector<task<int>> tasks;
+    for(int i = 0; i < 100; ++i) tasks.push_back(lookup(loop, i, ms(i % 30)));
+    const auto results = co_await when_all(std::move(tasks));
+    std::cout << results.size() << " results ";
+  });
+
+  timed("when_any  ", loop, [&]() -> task<void> {
+    const auto res = co_await when_any(lookup(loop, 1, 30ms), name(loop, 10ms));
+    std::cout << "winner " << res.index() << " (" << std::get<1>(res) << "), pending timers "
+              << loop.pending_timers() << " ";
+  });
+
+  timed("when_any  ", loop, [&]() -> task<void> {
+    std::vector<task<int>> tasks;
+    for(int i = 0; i < 10; ++i) tasks.push_back(lookup(loop, i, ms(50 - i)));
+    const auto res = co_await when_any(std::move(tasks));
+    std::cout << "winner " << res.index << " (" << res.value << "), pending timers " << loop.pending_timers() << " ";
+  });
+
+  timed("when_any  ", loop, [&]() -> task<void> {
+    try {
+      static_cast<void>(co_await when_any(std::vector<task<int>>()));
+    }
+    catch(const std::invalid_argument& ex) {
+      std::cout << ex.what() << " ";
+    }
+  });
+}
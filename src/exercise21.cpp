@@ -0,0 +1,527 @@
+// - Implement an I/O reactor for `task<T>` so that one thread can serve thousands of descriptors
+//   - `io_context` registers non-blocking descriptors with epoll in edge-triggered mode
+//   - `co_await io.readable(fd)` / `co_await io.writable(fd)` suspend until the descriptor is ready
+//   - `io_context::run()` resumes the coroutines whose descriptors became ready
+// - Build the operations on top of that
+//   - `async_read()`, `async_write()`, `async_accept()` try the system call first and wait only
+//     on `EAGAIN`
+//   - `async_sleep()` waits on a `timerfd`
+//   - regular files can't be registered with epoll; they are always ready, so we never wait on them
+// - Errors are reported as `std::system_error` in the awaiting coroutine
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <span>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return *result;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+  };
+
+  void start() const
+  {
+    std::coroutine_handle<promise_type>::from_promise(*promise_).resume();
+  }
+  [[nodiscard]] bool done() const noexcept
+  {
+    return std::coroutine_handle<promise_type>::from_promise(*promise_).done();
+  }
+
+  [[nodiscard]] decltype(auto) get_result() const &
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() const &&
+  {
+    return std::move(promise_)->get();
+  }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      bool await_ready() const noexcept
+      {
+        return std::coroutine_handle<promise_type>::from_promise(*p_).done();
+      }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        p_->continuation = caller;
+        return std::coroutine_handle<promise_type>::from_promise(*p_);
+      }
+      decltype(auto) await_resume() const { return std::move(*p_).get(); }
+    };
+    return awaiter{promise_.get()};
+  }
+
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* REACTOR *********
+
+[[noreturn]] inline void throw_errno(const char* what)
+{
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+inline void set_nonblocking(int fd)
+{
+  const int flags = ::fcntl(fd, F_GETFL);
+  if(flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) throw_errno("fcntl");
+}
+
+class io_context {
+public:
+  io_context() : epoll_fd_(::epoll_create1(EPOLL_CLOEXEC))
+  {
+    if(epoll_fd_ < 0) throw_errno("epoll_create1");
+  }
+  ~io_context() { ::close(epoll_fd_); }
+  io_context(const io_context&) = delete;
+  io_context& operator=(const io_context&) = delete;
+
+  [[nodiscard]] auto readable(int fd) { return wait_awaiter{*this, fd, &fd_state::reader}; }
+  [[nodiscard]] auto writable(int fd) { return wait_awaiter{*this, fd, &fd_state::writer}; }
+
+  // closes the descriptor and forgets about it; it must not have any waiting coroutine
+  void close(int fd) noexcept
+  {
+    if(auto it = fds_.find(fd); it != fds_.end()) {
+      if(it->second->registered) ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+      fds_.erase(it);
+    }
+    ::close(fd);
+  }
+
+  [[nodiscard]] std::size_t waiting() const noexcept { return waiting_; }
+
+  // runs until no coroutine waits for a descriptor
+  void run()
+  {
+    std::array<epoll_event, 256> events;
+    std::vector<std::coroutine_handle<>> ready;
+    while(waiting_ > 0) {
+      const int n = ::epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), -1);
+      if(n < 0) {
+        if(errno == EINTR) continue;
+        throw_errno("epoll_wait");
+      }
+      // collect first: a resumed coroutine may close descriptors reported later in this batch
+      for(int i = 0; i < n; ++i) {
+        auto& s = *static_cast<fd_state*>(events[i].data.ptr);
+        const auto ev = events[i].events;
+        if(ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) && s.reader) ready.push_back(std::exchange(s.reader, nullptr));
+        if(ev & (EPOLLOUT | EPOLLHUP | EPOLLERR) && s.writer) ready.push_back(std::exchange(s.writer, nullptr));
+      }
+      waiting_ -= ready.size();
+      for(auto h : ready) h.resume();
+      ready.clear();
+    }
+  }
+
+private:
+  struct fd_state {
+    bool registered = false;
+    std::coroutine_handle<> reader;
+    std::coroutine_handle<> writer;
+  };
+
+  struct wait_awaiter {
+    io_context& io;
+    int fd;
+    std::coroutine_handle<> fd_state::*waiter;
+
+    static bool await_ready() noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+      fd_state* s = io.state(fd);
+      if(!s) return false; // always ready
+      s->*waiter = h;
+      ++io.waiting_;
+      return true;
+    }
+    static void await_resume() noexcept {}
+  };
+
+  int epoll_fd_;
+  std::unordered_map<int, std::unique_ptr<fd_state>> fds_;
+  std::size_t waiting_ = 0;
+
+  // registers the descriptor on first use; returns `nullptr` for descriptors epoll does not
+  // support (regular files), which are always ready
+  fd_state* state(int fd)
+  {
+    auto& s = fds_[fd];
+    if(!s) s = std::make_unique<fd_state>();
+    if(!s->registered) {
+      epoll_event ev{};
+      ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+      ev.data.ptr = s.get();
+      if(::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        if(errno == EPERM) {
+          fds_.erase(fd);
+          return nullptr;
+        }
+        throw_errno("epoll_ctl");
+      }
+      s->registered = true;
+    }
+    return s.get();
+  }
+};
+
+
+// ********* OPERATIONS *********
+
+task<std::size_t> async_read(io_context& io, int fd, std::span<std::byte> buf)
+{
+  while(true) {
+    const auto n = ::read(fd, buf.data(), buf.size());
+    if(n >= 0) co_return static_cast<std::size_t>(n);
+    if(errno == EAGAIN || errno == EWOULDBLOCK)
+      co_await io.readable(fd);
+    else if(errno != EINTR)
+      throw_errno("read");
+  }
+}
+
+// writes the whole buffer
+task<void> async_write(io_context& io, int fd, std::span<const std::byte> buf)
+{
+  while(!buf.empty()) {
+    const auto n = ::write(fd, buf.data(), buf.size());
+    if(n >= 0)
+      buf = buf.subspan(static_cast<std::size_t>(n));
+    else if(errno == EAGAIN || errno == EWOULDBLOCK)
+      co_await io.writable(fd);
+    else if(errno != EINTR)
+      throw_errno("write");
+  }
+}
+
+// returns a non-blocking descriptor of the accepted connection
+task<int> async_accept(io_context& io, int listen_fd)
+{
+  while(true) {
+    const int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(fd >= 0) co_return fd;
+    if(errno == EAGAIN || errno == EWOULDBLOCK)
+      co_await io.readable(listen_fd);
+    else if(errno != EINTR && errno != ECONNABORTED)
+      throw_errno("accept4");
+  }
+}
+
+template<typename Rep, typename Period>
+task<void> async_sleep(io_context& io, std::chrono::duration<Rep, Period> d)
+{
+  const int fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if(fd < 0) throw_errno("timerfd_create");
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  itimerspec spec{};
+  // a zero value would disarm the timer
+  spec.it_value.tv_sec = ns / 1'000'000'000;
+  spec.it_value.tv_nsec = ns > 0 ? ns % 1'000'000'000 : 1;
+  if(::timerfd_settime(fd, 0, &spec, nullptr) < 0) {
+    ::close(fd);
+    throw_errno("timerfd_settime");
+  }
+  std::uint64_t expirations;
+  std::exception_ptr error;
+  try {
+    co_await async_read(io, fd, std::as_writable_bytes(std::span(&expirations, 1)));
+  }
+  catch(...) {
+    error = std::current_exception();
+  }
+  io.close(fd);
+  if(error) std::rethrow_exception(error);
+}
+
+
+// ********* EXAMPLE *********
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/un.h>
+
+using namespace std::chrono_literals;
+
+constexpr std::size_t message_size = 64;
+
+task<void> writer(io_context& io, int fd, int messages)
+{
+  std::array<std::byte, message_size> msg{};
+  for(int i = 0; i < messages; ++i) {
+    msg[0] = static_cast<std::byte>(i);
+    co_await async_write(io, fd, msg);
+    co_await async_sleep(io, 1ms);
+  }
+  io.close(fd);
+}
+
+// reads until the other side closes, returns the number of bytes
+task<std::size_t> reader(io_context& io, int fd)
+{
+  std::array<std::byte, 4096> buf;
+  std::size_t total = 0;
+  while(const auto n = co_await async_read(io, fd, buf)) total += n;
+  io.close(fd);
+  co_return total;
+}
+
+task<void> echo(io_context& io, int fd)
+{
+  std::array<std::byte, 4096> buf;
+  while(const auto n = co_await async_read(io, fd, buf))
+    co_await async_write(io, fd, std::span(buf).first(n));
+  io.close(fd);
+}
+
+task<void> server(io_context& io, int listen_fd, int clients, std::vector<task<void>>& sessions)
+{
+  for(int i = 0; i < clients; ++i) {
+    sessions.push_back(echo(io, co_await async_accept(io, listen_fd)));
+    sessions.back().start();
+  }
+  io.close(listen_fd);
+}
+
+task<std::size_t> client(io_context& io, int fd, int messages)
+{
+  std::array<std::byte, message_size> msg{};
+  std::array<std::byte, message_size> reply;
+  std::size_t total = 0;
+  for(int i = 0; i < messages; ++i) {
+    co_await async_write(io, fd, msg);
+    std::size_t got = 0;
+    while(got < reply.size()) got += co_await async_read(io, fd, std::span(reply).subspan(got));
+    total += got;
+  }
+  io.close(fd);
+  co_return total;
+}
+
+int main()
+{
+  io_context io;
+
+  // 1000 pipes served concurrently by one thread
+  {
+    constexpr int pipes = 1000;
+    constexpr int messages = 10;
+    std::vector<task<void>> writers;
+    std::vector<task<std::size_t>> readers;
+    for(int i = 0; i < pipes; ++i) {
+      int fds[2];
+      if(::pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) throw_errno("pipe2");
+      readers.push_back(reader(io, fds[0]));
+      writers.push_back(writer(io, fds[1], messages));
+    }
+    const auto start = std::chrono::steady_clock::now();
+    for(auto& t : readers) t.start();
+    for(auto& t : writers) t.start();
+    io.run();
+    std::size_t total = 0;
+    for(auto& t : readers) total += t.get_result();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << pipes << " pipes: " << total << " bytes in " << elapsed.count() << "ms\n";
+  }
+
+  // echo over socketpairs
+  {
+    std::vector<task<void>> echos;
+    std::vector<task<std::size_t>> clients;
+    for(int i = 0; i < 100; ++i) {
+      int fds[2];
+      if(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0) throw_errno("socketpair");
+      echos.push_back(echo(io, fds[0]));
+      clients.push_back(client(io, fds[1], 100));
+    }
+    for(auto& t : echos) t.start();
+    for(auto& t : clients) t.start();
+    io.run();
+    std::size_t total = 0;
+    for(auto& t : clients) total += t.get_result();
+    std::cout << "socketpairs: " << total << " bytes echoed\n";
+  }
+
+  // UNIX socket server accepting connections
+  {
+    char dir[] = "/tmp/coro-XXXXXX";
+    if(!::mkdtemp(dir)) throw_errno("mkdtemp");
+    const std::string path = std::string(dir) + "/echo.sock";
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    const int listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(listen_fd < 0 || ::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || ::listen(listen_fd, 128) < 0)
+      throw_errno("listen");
+
+    constexpr int connections = 50;
+    std::vector<task<void>> sessions;
+    const auto srv = server(io, listen_fd, connections, sessions);
+    srv.start();
+    std::vector<task<std::size_t>> clients;
+    for(int i = 0; i < connections; ++i) {
+      const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if(fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) throw_errno("connect");
+      set_nonblocking(fd);
+      clients.push_back(client(io, fd, 10));
+      clients.back().start();
+    }
+    io.run();
+    std::size_t total = 0;
+    for(auto& t : clients) total += t.get_result();
+    srv.get_result();
+    std::cout << "UNIX socket: " << total << " bytes echoed over " << connections << " connections\n";
+    ::unlink(path.c_str());
+    ::rmdir(dir);
+  }
+
+  // regular files are always ready
+  {
+    char path[] = "/tmp/coro-file-XXXXXX";
+    const int fd = ::mkstemp(path);
+    if(fd < 0) throw_errno("mkstemp");
+    ::unlink(path);
+    const std::string text = "hello from a temp file";
+    const auto w = async_write(io, fd, std::as_bytes(std::span(text)));
+    w.start();
+    ::lseek(fd, 0, SEEK_SET);
+    std::array<std::byte, 64> buf;
+    const auto r = async_read(io, fd, buf);
+    r.start();
+    std::cout << "temp file: " << std::string(reinterpret_cast<const char*>(buf.data()), r.get_result()) << "\n";
+    io.close(fd);
+  }
+}
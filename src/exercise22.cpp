@@ -0,0 +1,359 @@
+// - Implement `task<T, E>` that reports errors as values instead of exceptions
+//   - the promise stores the result as `std::expected<T, E>`
+//   - `co_return std::unexpected(e)` completes the task with an error
+//   - `co_await t` yields the `std::expected<T, E>` of the awaited task
+//   - `co_await propagate(t)` yields the value of the awaited task or, on error, completes the
+//     awaiting task with the same error without resuming it (like `?` in Rust)
+//     - nothing is thrown, so the task builds with `-fno-exceptions`
+// - Compare the latency of the error path with the throwing task from exercise 11
+
+#include <concepts>
+#include <coroutine>
+#include <exception>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+template<typename T, typename E>
+class expected_storage {
+protected:
+  std::optional<std::expected<T, E>> result;
+public:
+  using value_type = T;
+  using error_type = E;
+
+  [[nodiscard]] bool ready() const noexcept { return result.has_value(); }
+  [[nodiscard]] bool has_error() const noexcept { return result && !result->has_value(); }
+
+  template<typename... Args>
+  void set_value(Args&&... args) noexcept(std::is_nothrow_constructible_v<T, Args...> || std::is_void_v<T>)
+  {
+    result.emplace(std::in_place, std::forward<Args>(args)...);
+  }
+  template<typename G>
+    requires std::constructible_from<E, G>
+  void set_error(G&& error) noexcept(std::is_nothrow_constructible_v<E, G>)
+  {
+    result.emplace(std::unexpect, std::forward<G>(error));
+  }
+
+  [[nodiscard]] E& error() noexcept { return result->error(); }
+  [[nodiscard]] const std::expected<T, E>& get() const & noexcept { return *result; }
+  [[nodiscard]] std::expected<T, E>&& get() && noexcept { return *std::move(result); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T, typename E>
+struct task_promise_storage : expected_storage<T, E> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+  {
+    this->set_value(std::forward<U>(value));
+  }
+  template<typename G>
+    requires std::constructible_from<E, G>
+  void return_value(std::unexpected<G> error) noexcept(noexcept(this->set_error(std::move(error).error())))
+  {
+    this->set_error(std::move(error).error());
+  }
+};
+
+// a promise cannot have both `return_void()` and `return_value()`, a successful `task<void, E>`
+// ends with `co_return {};`
+template<typename E>
+struct task_promise_storage<void, E> : expected_storage<void, E> {
+  void return_value(std::expected<void, E> r) noexcept(std::is_nothrow_move_constructible_v<E>)
+  {
+    if(r)
+      this->set_value();
+    else
+      this->set_error(std::move(r).error());
+  }
+};
+
+// a promise able to take the error of an awaited task
+template<typename P, typename E>
+concept error_sink = requires(P& p, E&& error) {
+  p.set_error(std::move(error));
+  { p.complete() } noexcept -> std::same_as<std::coroutine_handle<>>;
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T, std::move_constructible E>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T, E> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    // set by `propagate()`: hands our error to the awaiting task instead of resuming it
+    std::coroutine_handle<> (*on_error)(std::coroutine_handle<> continuation, E& error) noexcept = nullptr;
+
+    // the coroutine to run once the task has its result
+    std::coroutine_handle<> complete() noexcept
+    {
+      if(on_error && this->has_error()) return on_error(continuation, this->error());
+      return continuation;
+    }
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().complete();
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+    // errors are values here, an escaping exception is a bug
+    [[noreturn]] static void unhandled_exception() noexcept { std::terminate(); }
+  };
+
+  // starts the task from a non-coroutine context; returns once it suspends for the first time
+  void start() const
+  {
+    std::coroutine_handle<promise_type>::from_promise(*promise_).resume();
+  }
+  // a task that failed in `propagate()` has a result while still suspended
+  [[nodiscard]] bool done() const noexcept { return promise_->ready(); }
+
+  [[nodiscard]] const std::expected<T, E>& get_result() const & noexcept { return promise_->get(); }
+  [[nodiscard]] std::expected<T, E>&& get_result() const && noexcept { return std::move(*promise_).get(); }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      bool await_ready() const noexcept { return p_->ready(); }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        p_->continuation = caller;
+        return std::coroutine_handle<promise_type>::from_promise(*p_);
+      }
+      std::expected<T, E>&& await_resume() const noexcept { return std::move(*p_).get(); }
+    };
+    return awaiter{promise_.get()};
+  }
+
+  // yields the value of `t`; on error the awaiting task completes with that error and is not
+  // resumed anymore
+  friend auto propagate(const task& t) noexcept { return propagate_awaiter{t.promise_.get()}; }
+
+private:
+  struct propagate_awaiter {
+    promise_type* p_;
+    bool await_ready() const noexcept { return p_->ready() && !p_->has_error(); }
+    template<detail::error_sink<E> Caller>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Caller> caller) const noexcept
+    {
+      p_->continuation = caller;
+      p_->on_error = [](std::coroutine_handle<> c, E& error) noexcept -> std::coroutine_handle<> {
+        auto& p = std::coroutine_handle<Caller>::from_address(c.address()).promise();
+        p.set_error(std::move(error));
+        return p.complete();
+      };
+      if(p_->ready()) return p_->complete();
+      return std::coroutine_handle<promise_type>::from_promise(*p_);
+    }
+    decltype(auto) await_resume() const noexcept
+    {
+      if constexpr(!std::is_void_v<T>)
+        return *std::move(*p_).get();
+    }
+  };
+
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <chrono>
+#include <iostream>
+#include <string_view>
+
+enum class parse_error { empty, not_a_number };
+
+const char* to_string(parse_error e)
+{
+  switch(e) {
+  case parse_error::empty: return "empty";
+  case parse_error::not_a_number: return "not a number";
+  }
+  return "unknown";
+}
+
+task<int, parse_error> parse(std::string_view s)
+{
+  if(s.empty()) co_return std::unexpected(parse_error::empty);
+  int v = 0;
+  for(const char c : s) {
+    if(c < '0' || c > '9') co_return std::unexpected(parse_error::not_a_number);
+    v = v * 10 + (c - '0');
+  }
+  co_return v;
+}
+
+// stops at the first failing parse
+task<int, parse_error> sum(std::string_view a, std::string_view b)
+{
+  const int x = co_await propagate(parse(a));
+  const int y = co_await propagate(parse(b));
+  co_return x + y;
+}
+
+task<void, parse_error> print_sum(std::string_view a, std::string_view b)
+{
+  if(const auto s = co_await sum(a, b))
+    std::cout << a << " + " << b << " = " << *s << "\n";
+  else
+    std::cout << a << " + " << b << ": " << to_string(s.error()) << "\n";
+  co_return {};
+}
+
+constexpr int depth = 8;
+
+task<int, parse_error> fail_at(int d)
+{
+  if(d == 0) co_return std::unexpected(parse_error::not_a_number);
+  co_return co_await propagate(fail_at(d - 1)) + 1;
+}
+
+#if __cpp_exceptions
+#include <stdexcept>
+
+// the exercise 11 approach, reduced to what the comparison needs
+namespace throwing {
+
+template<typename T>
+struct [[nodiscard]] task {
+  struct promise_type {
+    std::optional<T> result;
+    std::exception_ptr exception;
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+    void unhandled_exception() noexcept { exception = std::current_exception(); }
+    void return_value(T v) noexcept { result = std::move(v); }
+    T get()
+    {
+      if(exception) std::rethrow_exception(exception);
+      return *std::move(result);
+    }
+  };
+
+  void start() const { std::coroutine_handle<promise_type>::from_promise(*promise_).resume(); }
+  T get_result() const { return promise_->get(); }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      static bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        p_->continuation = caller;
+        return std::coroutine_handle<promise_type>::from_promise(*p_);
+      }
+      T await_resume() const { return p_->get(); }
+    };
+    return awaiter{promise_.get()};
+  }
+
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+}
+
+throwing::task<int> throw_at(int d)
+{
+  if(d == 0) throw std::invalid_argument("not a number");
+  co_return co_await throw_at(d - 1) + 1;
+}
+#endif
+
+template<typename F>
+void benchmark(const char* name, F fails)
+{
+  constexpr int iterations = 100'000;
+  int failures = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < iterations; ++i) failures += fails();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << name << ": " << std::chrono::duration<double, std::nano>(elapsed).count() / iterations
+            << " ns per failed chain of " << depth << " tasks (" << failures << " failures)\n";
+}
+
+int main()
+{
+  for(const auto& [a, b] : {std::pair{"12", "30"}, {"12", "x"}, {"", "30"}}) {
+    const auto t = print_sum(a, b);
+    t.start();
+  }
+
+  benchmark("std::expected", [] {
+    const auto t = fail_at(depth);
+    t.start();
+    return !t.get_result().has_value();
+  });
+#if __cpp_exceptions
+  benchmark("exceptions   ", [] {
+    const auto t = throw_at(depth);
+    t.start();
+    try {
+      return t.get_result() < 0;
+    }
+    catch(const std::exception&) {
+      return true;
+    }
+  });
+#else
+  std::cout << "built with -fno-exceptions, the throwing task is not available\n";
+#endif
+}
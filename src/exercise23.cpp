@@ -0,0 +1,369 @@
+// - Let the awaiting coroutine provide the slot the result of a `task<T>` is constructed in
+//   - `co_return` constructs the value in the slot, by default the `std::optional<T>` in the
+//     promise
+//   - `co_await t.into(slot)` makes `co_return` construct the value right in the caller's
+//     `std::optional<T>`
+//   - `co_return co_await delegate(t)` hands the caller's own slot down to `t`, so a result passed
+//     through many layers of tasks is moved only once, from the `co_return` in the innermost task
+// - Move the result out of an rvalue task: `std::move(t).get_result()` returns `T&&`
+// - Count copies and moves of a large result passed through 8 layers of tasks
+
+#include <concepts>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <utility>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+  // where the value is constructed; redirected by the awaiting coroutine before the task runs
+  std::optional<T>* slot = &result;
+public:
+  using value_type = T;
+
+  // a value the task constructed already, if it completed before, is moved to the new slot
+  void set_slot(std::optional<T>& s) noexcept(std::is_nothrow_move_constructible_v<T>)
+  {
+    if(slot != &s && slot->has_value()) {
+      s.emplace(std::move(**slot));
+      slot->reset();
+    }
+    slot = &s;
+  }
+  [[nodiscard]] std::optional<T>& get_slot() const noexcept { return *slot; }
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    slot->emplace(std::forward<U>(value));
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return **slot;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return std::move(**slot);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+// returned by `co_await delegate(t)`: the value is already in the slot of the awaiting coroutine
+struct result_in_place {};
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+  static void return_value(result_in_place) noexcept {}
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+template<typename P, typename T>
+concept result_slot_provider = requires(const P& p) {
+  { p.get_slot() } noexcept -> std::same_as<std::optional<T>&>;
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+  };
+
+  // starts the task from a non-coroutine context; returns once it suspends for the first time
+  void start() const
+  {
+    std::coroutine_handle<promise_type>::from_promise(*promise_).resume();
+  }
+
+  [[nodiscard]] decltype(auto) get_result() const &
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() &&
+  {
+    return std::move(*promise_).get();
+  }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter : awaiter_base {
+      decltype(auto) await_resume() const { return std::move(*this->p_).get(); }
+    };
+    return awaiter{{promise_.get()}};
+  }
+
+  // `co_return` constructs the value right in `slot`; it is moved there if the task completed already
+  auto into(std::optional<T>& slot) const noexcept(std::is_nothrow_move_constructible_v<T>)
+    requires(!std::is_void_v<T>)
+  {
+    struct awaiter : awaiter_base {
+      void await_resume() const { this->p_->rethrow_if_exception(); }
+    };
+    promise_->set_slot(slot);
+    return awaiter{{promise_.get()}};
+  }
+
+  // `co_return co_await delegate(t);` makes `t` construct its value in the slot of the awaiting
+  // task
+  friend auto delegate(const task& t) noexcept
+    requires(!std::is_void_v<T>)
+  {
+    return delegate_awaiter{{t.promise_.get()}};
+  }
+
+private:
+  struct awaiter_base {
+    promise_type* p_;
+    bool await_ready() const noexcept
+    {
+      return std::coroutine_handle<promise_type>::from_promise(*p_).done();
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+    {
+      p_->continuation = caller;
+      return std::coroutine_handle<promise_type>::from_promise(*p_);
+    }
+  };
+
+  struct delegate_awaiter : awaiter_base {
+    static bool await_ready() noexcept { return false; }
+    template<detail::result_slot_provider<T> Caller>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Caller> caller) const noexcept
+    {
+      // a task that completed already has its value moved to the slot, and is not resumed again
+      this->p_->set_slot(caller.promise().get_slot());
+      if(std::coroutine_handle<promise_type>::from_promise(*this->p_).done()) return caller;
+      return awaiter_base::await_suspend(caller);
+    }
+    detail::result_in_place await_resume() const
+    {
+      this->p_->rethrow_if_exception();
+      return {};
+    }
+  };
+
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+// a multi-KB response that counts how often it is copied and moved
+struct response {
+  inline static int copies = 0;
+  inline static int moves = 0;
+
+  std::array<char, 8192> payload{};
+  int status = 0;
+
+  explicit response(int s) : status(s) {}
+  response(const response& other) : payload(other.payload), status(other.status) { ++copies; }
+  response(response&& other) noexcept : payload(other.payload), status(other.status) { ++moves; }
+  response& operator=(const response&) = delete;
+  response& operator=(response&&) = delete;
+};
+
+constexpr int layers = 8;
+
+task<response> fetch(int status)
+{
+  co_return response(status);
+}
+
+task<response> layer_move(int depth)
+{
+  if(depth == 0) co_return co_await fetch(200);
+  co_return co_await layer_move(depth - 1);
+}
+
+task<response> layer_delegate(int depth)
+{
+  if(depth == 0) co_return co_await delegate(fetch(200));
+  co_return co_await delegate(layer_delegate(depth - 1));
+}
+
+task<response> failing()
+{
+  throw std::runtime_error("backend unavailable");
+  co_return response(500);
+}
+
+task<response> layer_failing()
+{
+  co_return co_await delegate(failing());
+}
+
+task<int> consume_move()
+{
+  const response r = co_await layer_move(layers);
+  co_return r.status;
+}
+
+task<int> consume_into()
+{
+  std::optional<response> r;
+  co_await layer_delegate(layers).into(r);
+  co_return r->status;
+}
+
+// the value of a task that completed already is moved into the slot
+task<int> consume_completed()
+{
+  const auto t = fetch(201);
+  t.start();
+  std::optional<response> r;
+  co_await t.into(r);
+  co_return r ? r->status : -1;
+}
+
+task<response> delegate_completed()
+{
+  const auto t = fetch(202);
+  t.start();
+  co_return co_await delegate(t);
+}
+
+task<int> consume_delegate_completed()
+{
+  std::optional<response> r;
+  co_await delegate_completed().into(r);
+  co_return r ? r->status : -1;
+}
+
+task<void> consume_failing()
+{
+  try {
+    std::optional<response> r;
+    co_await layer_failing().into(r);
+  }
+  catch(const std::exception& ex) {
+    std::cout << "caught: " << ex.what() << "\n";
+  }
+}
+
+template<typename F>
+void report(const char* name, F consume)
+{
+  constexpr int iterations = 100'000;
+  response::copies = response::moves = 0;
+  long sum = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < iterations; ++i) {
+    auto t = consume();
+    t.start();
+    sum += std::move(t).get_result();
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << name << ": " << static_cast<double>(response::copies) / iterations << " copies, "
+            << static_cast<double>(response::moves) / iterations << " moves, "
+            << std::chrono::duration<double, std::nano>(elapsed).count() / iterations << " ns per request (checksum "
+            << sum << ")\n";
+}
+
+int main()
+{
+  report("co_return co_await t          ", consume_move);
+  report("co_await delegate(t) + into() ", consume_into);
+
+  const auto f = consume_failing();
+  f.start();
+
+  const auto c = consume_completed();
+  c.start();
+  std::cout << "into() after completion: " << c.get_result() << "\n";
+  const auto d = consume_delegate_completed();
+  d.start();
+  std::cout << "delegate() after completion: " << d.get_result() << "\n";
+
+  // the result is moved, not copied, out of an rvalue task
+  response::copies = response::moves = 0;
+  auto t = fetch(204);
+  t.start();
+  const response r = std::move(t).get_result();
+  std::cout << "get_result() &&: " << r.status << ", " << response::copies << " copies, " << response::moves
+            << " moves\n";
+}
@@ -0,0 +1,224 @@
+// - Design a `task<T>` whose directly awaited children can have their frames allocated inside the
+//   frame of the awaiting coroutine (heap allocation elision, HALO)
+//   - the compiler elides the allocation only if it can prove that the child frame is created and
+//     destroyed within the awaiting coroutine:
+//     - the task starts lazily, so nothing runs before it is awaited
+//     - the task owns a plain `std::coroutine_handle<>` and destroys it in its destructor, no
+//       deleter object or type erasure hides the `destroy()` call
+//     - the task is awaited as a temporary, `operator co_await` is `&&`-qualified so the handle
+//       cannot be stored beyond the `co_await` expression
+//     - everything is visible and `noexcept`, so the coroutine ramp can be inlined
+//   - Clang 20+ also offers `[[clang::coro_await_elidable]]` which guarantees the elision of
+//     directly awaited calls
+// - Verify it: count frame allocations with an instrumented `operator new` of the promise and
+//   return a non-zero exit code if a nested `co_await` chain allocates more than expected
+//   - GCC and clang before 20 do not guarantee the elision: there every frame must be allocated,
+//     exactly, so that the count itself is checked
+
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <optional>
+#include <utility>
+
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(clang::coro_await_elidable)
+#define CORO_AWAIT_ELIDABLE [[clang::coro_await_elidable]]
+#else
+#define CORO_AWAIT_ELIDABLE
+#endif
+
+// can the frames of directly awaited children be elided by this compiler
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(clang::coro_await_elidable) && defined(__OPTIMIZE__)
+inline constexpr bool frame_elision = true;
+#else
+inline constexpr bool frame_elision = false;
+#endif
+
+inline std::size_t frame_allocations = 0;
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+
+  // counts the frames that were not elided
+  static void* operator new(std::size_t size)
+  {
+    ++frame_allocations;
+    return ::operator new(size);
+  }
+  static void operator delete(void* ptr, std::size_t size) noexcept { ::operator delete(ptr, size); }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] CORO_AWAIT_ELIDABLE task {
+  struct promise_type : detail::task_promise_storage<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept
+    {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+  };
+
+  task(task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+  task& operator=(task&&) = delete;
+  ~task()
+  {
+    if(handle_) handle_.destroy();
+  }
+
+  // starts the task from a non-coroutine context; returns once it suspends for the first time
+  void start() const { handle_.resume(); }
+  [[nodiscard]] decltype(auto) get_result() && { return std::move(handle_.promise()).get(); }
+
+  auto operator co_await() && noexcept
+  {
+    struct awaiter {
+      std::coroutine_handle<promise_type> h;
+      static bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        h.promise().continuation = caller;
+        return h;
+      }
+      decltype(auto) await_resume() const { return std::move(h.promise()).get(); }
+    };
+    return awaiter{handle_};
+  }
+
+private:
+  explicit task(std::coroutine_handle<promise_type> h) noexcept : handle_(h) {}
+  std::coroutine_handle<promise_type> handle_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <iostream>
+
+// distinct functions, so each level can be inlined into its caller
+template<int Depth>
+task<int> level()
+{
+  if constexpr(Depth == 0)
+    co_return 1;
+  else
+    co_return co_await level<Depth - 1>() + 1;
+}
+
+constexpr int depth = 8;
+
+// returns false if the chain allocated more frames than expected, or, without elision, not exactly
+// as many
+template<int Depth>
+bool check(std::size_t expected)
+{
+  const auto before = frame_allocations;
+  auto t = level<Depth>();
+  t.start();
+  const int result = std::move(t).get_result();
+  const auto frames = frame_allocations - before;
+
+  std::cout << "chain of " << Depth + 1 << " tasks: result " << result << ", " << frames
+            << " frame allocations, expected " << (frame_elision ? "at most " : "") << expected << "\n";
+  return result == Depth + 1 && (frame_elision ? frames <= expected : frames == expected);
+}
+
+int main()
+{
+  if(!frame_elision)
+    std::cout << "frame elision is not available with this compiler, checking that every frame is allocated\n";
+
+  // only the outermost frame, created outside of a coroutine, has to be allocated
+  const auto expected = [](int d) { return frame_elision ? std::size_t{1} : static_cast<std::size_t>(d + 1); };
+
+  bool ok = true;
+  ok &= check<0>(expected(0));
+  ok &= check<1>(expected(1));
+  ok &= check<depth>(expected(depth));
+
+  std::cout << (ok ? "OK" : "FAILED") << "\n";
+  return ok ? 0 : 1;
+}
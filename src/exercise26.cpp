@@ -0,0 +1,619 @@
+// - Keep a registry of all live `task<T>` frames to find hung or slow coroutines
+//   - every promise embeds an intrusive node linked into a global list while the frame is alive
+//   - `await_transform()` records where (`std::source_location`) and since when a coroutine is
+//     suspended, and which coroutine awaits which
+//   - `registry::dump()` prints the "async stack" of every await chain, innermost first
+//     - also on a signal: a dedicated thread waits for it with `sigtimedwait()`, as the registry
+//       cannot be walked safely from a signal handler
+// - Collect a histogram of suspension times per `co_await` site to see where latency builds up
+// - Opt-in at compile time with `-DCORO_REGISTRY=1` (the `exercise26_registry` target), by default
+//   nothing is recorded
+//   - enabled, a `co_await` takes no lock: its site is looked up in a per-thread cache, and frames
+//     are linked into a list owned by the thread creating them
+
+#ifndef CORO_REGISTRY
+#define CORO_REGISTRY 0
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <concepts>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <source_location>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <signal.h>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* REGISTRY *********
+
+namespace registry {
+
+using clock = std::chrono::steady_clock;
+
+inline void print_duration(std::ostream& os, clock::duration d)
+{
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  if(ns >= 1'000'000'000)
+    os << static_cast<double>(ns) / 1e9 << "s";
+  else if(ns >= 1'000'000)
+    os << static_cast<double>(ns) / 1e6 << "ms";
+  else if(ns >= 1'000)
+    os << static_cast<double>(ns) / 1e3 << "us";
+  else
+    os << ns << "ns";
+}
+
+// time spent suspended at one `co_await`, in power-of-two buckets of nanoseconds
+class site_stats {
+public:
+  static constexpr std::size_t bucket_count = 48;
+
+  explicit site_stats(const std::source_location& loc) noexcept : file_(loc.file_name()), line_(loc.line()) {}
+
+  void add(clock::duration d) noexcept
+  {
+    const auto ns = static_cast<std::uint64_t>(std::max<clock::rep>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(), 1));
+    const auto b = std::min<std::size_t>(std::bit_width(ns) - 1, bucket_count - 1);
+    buckets_[b].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] const char* file() const noexcept { return file_; }
+  [[nodiscard]] std::uint_least32_t line() const noexcept { return line_; }
+
+  void print(std::ostream& os) const
+  {
+    std::array<std::uint64_t, bucket_count> counts;
+    std::uint64_t total = 0;
+    for(std::size_t b = 0; b < bucket_count; ++b)
+      total += counts[b] = buckets_[b].load(std::memory_order_relaxed);
+    if(total == 0) return;
+
+    // the upper bound of the bucket holding the given quantile
+    const auto quantile = [&](double q) {
+      const auto rank = static_cast<std::uint64_t>(q * static_cast<double>(total - 1));
+      std::uint64_t seen = 0;
+      std::size_t b = 0;
+      while((seen += counts[b]) <= rank) ++b;
+      return std::chrono::nanoseconds(std::uint64_t{2} << b);
+    };
+    os << file_ << ":" << line_ << ": " << total << " suspensions, p50 < ";
+    print_duration(os, quantile(0.5));
+    os << ", p99 < ";
+    print_duration(os, quantile(0.99));
+    os << ", max < ";
+    print_duration(os, quantile(1.0));
+    os << "\n";
+    for(std::size_t b = 0; b < bucket_count; ++b) {
+      if(!counts[b]) continue;
+      os << "    < ";
+      print_duration(os, std::chrono::nanoseconds(std::uint64_t{2} << b));
+      os << ": " << counts[b] << "\n";
+    }
+  }
+
+private:
+  const char* file_;
+  std::uint_least32_t line_;
+  std::array<std::atomic<std::uint64_t>, bucket_count> buckets_{};
+};
+
+namespace detail {
+
+inline std::mutex sites_mutex;
+using site_key = std::tuple<const char*, std::uint_least32_t, std::uint_least32_t>;
+inline std::map<site_key, std::unique_ptr<site_stats>> sites;
+
+}
+
+// the statistics of a `co_await` site live until the end of the program
+// - a thread looks a site up in the global map once, then finds it in its own direct-mapped cache
+inline site_stats& site_for(const std::source_location& loc)
+{
+  struct cached {
+    const char* file = nullptr;
+    std::uint_least32_t line = 0;
+    std::uint_least32_t column = 0;
+    site_stats* site = nullptr;
+  };
+  static constexpr std::size_t cache_size = 64;
+  thread_local std::array<cached, cache_size> cache;
+
+  auto& c = cache[(std::bit_cast<std::uintptr_t>(loc.file_name()) ^ loc.line() * 31 ^ loc.column()) % cache_size];
+  if(c.site && c.file == loc.file_name() && c.line == loc.line() && c.column == loc.column()) return *c.site;
+
+  const std::scoped_lock lock(detail::sites_mutex);
+  auto& s = detail::sites[{loc.file_name(), loc.line(), loc.column()}];
+  if(!s) s = std::make_unique<site_stats>(loc);
+  c = {loc.file_name(), loc.line(), loc.column(), s.get()};
+  return *s;
+}
+
+#if CORO_REGISTRY
+
+class frame_node;
+
+namespace detail {
+
+// the frames created by one thread; its mutex is contended only by frames destroyed on other
+// threads and by `dump()`
+struct frame_list {
+  std::mutex mutex;
+  frame_node* head = nullptr;
+  frame_list* next = nullptr;  // the list of another thread, the lists are never removed
+};
+
+inline std::atomic<frame_list*> frame_lists{nullptr};
+
+// the list is leaked on purpose: the frames of a thread may outlive it
+inline frame_list& local_frames()
+{
+  thread_local frame_list* const list = [] {
+    auto* l = new frame_list;
+    l->next = frame_lists.load(std::memory_order_relaxed);
+    while(!frame_lists.compare_exchange_weak(l->next, l, std::memory_order_release, std::memory_order_relaxed)) {}
+    return l;
+  }();
+  return *list;
+}
+
+}
+
+// links a coroutine frame into the registry for its lifetime
+class frame_node {
+public:
+  explicit frame_node(const char* name) noexcept : name_(name), list_(detail::local_frames())
+  {
+    const std::scoped_lock lock(list_.mutex);
+    next_ = list_.head;
+    if(next_) next_->prev_ = this;
+    list_.head = this;
+  }
+  frame_node(const frame_node&) = delete;
+  frame_node& operator=(const frame_node&) = delete;
+  ~frame_node()
+  {
+    const std::scoped_lock lock(list_.mutex);
+    (prev_ ? prev_->next_ : list_.head) = next_;
+    if(next_) next_->prev_ = prev_;
+  }
+
+  void set_awaiter(frame_node& awaiter) noexcept { awaiter_.store(&awaiter, std::memory_order_release); }
+
+  // called before the coroutine may be resumed by someone else
+  void suspended(site_stats& site) noexcept
+  {
+    since_.store(clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    site_.store(&site, std::memory_order_release);
+  }
+  void resumed() noexcept
+  {
+    if(site_stats* s = site_.exchange(nullptr, std::memory_order_acq_rel))
+      s->add(clock::now() - clock::time_point(clock::duration(since_.load(std::memory_order_relaxed))));
+  }
+
+  friend void dump(std::ostream& os);
+
+private:
+  const char* name_;
+  detail::frame_list& list_;
+  frame_node* prev_ = nullptr;  // guarded by the mutex of `list_`
+  frame_node* next_ = nullptr;
+  std::atomic<frame_node*> awaiter_{nullptr};  // the coroutine awaiting this one
+  std::atomic<site_stats*> site_{nullptr};     // where the coroutine is suspended, `nullptr` if running
+  std::atomic<clock::rep> since_{0};
+};
+
+// prints every await chain, from the innermost coroutine to the outermost
+// - all the lists are locked, as an await chain may span frames created by different threads; frames
+//   lock a single list, so that cannot deadlock
+inline void dump(std::ostream& os)
+{
+  std::vector<std::unique_lock<std::mutex>> locks;
+  auto* const lists = detail::frame_lists.load(std::memory_order_acquire);
+  for(auto* l = lists; l; l = l->next) locks.emplace_back(l->mutex);
+  const auto now = clock::now();
+
+  std::vector<const frame_node*> frames;
+  std::set<const frame_node*> awaiting;
+  for(auto* l = lists; l; l = l->next)
+    for(const frame_node* f = l->head; f; f = f->next_) {
+      frames.push_back(f);
+      if(const auto* a = f->awaiter_.load(std::memory_order_acquire)) awaiting.insert(a);
+    }
+
+  os << "=== " << frames.size() << " live coroutines ===\n";
+  for(const frame_node* leaf : frames) {
+    if(awaiting.contains(leaf)) continue;
+    os << "async stack:\n";
+    int depth = 0;
+    for(const frame_node* f = leaf; f; f = f->awaiter_.load(std::memory_order_acquire)) {
+      os << "  #" << depth++ << " " << f->name_;
+      if(const site_stats* s = f->site_.load(std::memory_order_acquire)) {
+        os << " suspended at " << s->file() << ":" << s->line() << " for ";
+        print_duration(os, now - clock::time_point(clock::duration(f->since_.load(std::memory_order_relaxed))));
+      }
+      else
+        os << " running";
+      os << "\n";
+    }
+  }
+}
+
+#else
+
+struct frame_node {
+  explicit frame_node(const char*) noexcept {}
+};
+
+inline void dump(std::ostream& os) { os << "built without CORO_REGISTRY\n"; }
+
+#endif
+
+inline void print_histograms(std::ostream& os)
+{
+  const std::scoped_lock lock(detail::sites_mutex);
+  for(const auto& [key, stats] : detail::sites) stats->print(os);
+}
+
+// dumps the registry whenever the process receives `sig`
+// - construct it before starting other threads: they inherit the blocked signal, so only this
+//   thread receives it
+class signal_dumper {
+public:
+  signal_dumper(int sig, std::ostream& os)
+  {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, sig);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    thread_ = std::jthread([set, &os](std::stop_token st) {
+      const timespec timeout{0, 100'000'000};
+      while(!st.stop_requested())
+        if(sigtimedwait(&set, nullptr, &timeout) > 0) dump(os);
+    });
+  }
+
+private:
+  std::jthread thread_;
+};
+
+template<typename A>
+decltype(auto) get_awaiter(A&& awaitable)
+{
+  if constexpr(requires { std::forward<A>(awaitable).operator co_await(); })
+    return std::forward<A>(awaitable).operator co_await();
+  else
+    return std::forward<A>(awaitable);
+}
+
+#if CORO_REGISTRY
+
+// marks the frame as suspended at `site` for the duration of the inner await
+template<typename Awaiter>
+struct tracked_awaiter {
+  Awaiter inner;
+  frame_node& node;
+  site_stats& site;
+
+  bool await_ready() { return inner.await_ready(); }
+  template<typename Promise>
+  auto await_suspend(std::coroutine_handle<Promise> h)
+  {
+    node.suspended(site);
+    using result = decltype(inner.await_suspend(h));
+    if constexpr(std::same_as<result, bool>) {
+      const bool suspend = inner.await_suspend(h);
+      if(!suspend) node.resumed();
+      return suspend;
+    }
+    else
+      return inner.await_suspend(h);
+  }
+  decltype(auto) await_resume()
+  {
+    node.resumed();
+    return inner.await_resume();
+  }
+};
+template<typename Awaiter>
+tracked_awaiter(Awaiter&&, frame_node&, site_stats&) -> tracked_awaiter<Awaiter>;
+
+#endif
+
+}
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return *result;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    [[no_unique_address]] registry::frame_node node;
+
+    // the default argument is evaluated in the coroutine, naming it
+    explicit promise_type(std::source_location loc = std::source_location::current()) noexcept :
+        node(loc.function_name())
+    {
+    }
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+
+#if CORO_REGISTRY
+    // the default argument is evaluated at the `co_await`
+    template<typename A>
+    auto await_transform(A&& awaitable, std::source_location loc = std::source_location::current())
+    {
+      if constexpr(requires { awaitable.registry_node(); }) awaitable.registry_node().set_awaiter(node);
+      return registry::tracked_awaiter{registry::get_awaiter(std::forward<A>(awaitable)), node,
+                                       registry::site_for(loc)};
+    }
+#endif
+  };
+
+  // starts the task from a non-coroutine context; returns once it suspends for the first time
+  void start() const
+  {
+    std::coroutine_handle<promise_type>::from_promise(*promise_).resume();
+  }
+  [[nodiscard]] bool done() const noexcept
+  {
+    return std::coroutine_handle<promise_type>::from_promise(*promise_).done();
+  }
+
+  [[nodiscard]] decltype(auto) get_result() const &
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() &&
+  {
+    return std::move(*promise_).get();
+  }
+
+  [[nodiscard]] registry::frame_node& registry_node() const noexcept { return promise_->node; }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      bool await_ready() const noexcept
+      {
+        return std::coroutine_handle<promise_type>::from_promise(*p_).done();
+      }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        p_->continuation = caller;
+        return std::coroutine_handle<promise_type>::from_promise(*p_);
+      }
+      decltype(auto) await_resume() const { return std::move(*p_).get(); }
+    };
+    return awaiter{promise_.get()};
+  }
+
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* EVENT LOOP *********
+
+#include <functional>
+#include <queue>
+
+// single-threaded loop resuming coroutines when their timers expire
+class event_loop {
+public:
+  using clock = std::chrono::steady_clock;
+
+  template<typename Rep, typename Period>
+  [[nodiscard]] auto sleep_for(std::chrono::duration<Rep, Period> d)
+  {
+    struct awaiter {
+      event_loop& loop;
+      clock::time_point deadline;
+      static bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) const { loop.timers_.push({deadline, h}); }
+      static void await_resume() noexcept {}
+    };
+    return awaiter{*this, clock::now() + d};
+  }
+
+  void run()
+  {
+    while(!timers_.empty()) {
+      const auto t = timers_.top();
+      timers_.pop();
+      std::this_thread::sleep_until(t.deadline);
+      t.handle.resume();
+    }
+  }
+
+private:
+  struct timer {
+    clock::time_point deadline;
+    std::coroutine_handle<> handle;
+    bool operator>(const timer& other) const noexcept { return deadline > other.deadline; }
+  };
+  std::priority_queue<timer, std::vector<timer>, std::greater<>> timers_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <iostream>
+
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+
+task<bool> cache_lookup(event_loop& loop, int id)
+{
+  co_await loop.sleep_for(100us);
+  co_return id % 4 != 0;
+}
+
+// every 4th request hits the slow path
+task<int> query_database(event_loop& loop, int id)
+{
+  co_await loop.sleep_for(id % 8 == 0 ? 20ms : 2ms);
+  co_return id;
+}
+
+task<int> handle_request(event_loop& loop, int id)
+{
+  // not `if(co_await ...)`: GCC 12 miscompiles a coroutine with a `co_await` as the condition
+  const bool cached = co_await cache_lookup(loop, id);
+  if(cached) co_return id;
+  co_return co_await query_database(loop, id);
+}
+
+task<long> connection(event_loop& loop, int first, int count)
+{
+  long sum = 0;
+  for(int id = first; id < first + count; ++id) sum += co_await handle_request(loop, id);
+  co_return sum;
+}
+
+task<void> watchdog(event_loop& loop)
+{
+  co_await loop.sleep_for(15ms);
+  registry::dump(std::cout);
+
+  // the same from the dumper thread, as `kill -USR1 <pid>` would do
+  kill(getpid(), SIGUSR1);
+  co_await loop.sleep_for(30ms);
+}
+
+int main()
+{
+  const registry::signal_dumper dumper(SIGUSR1, std::cout);
+
+  event_loop loop;
+  std::vector<task<long>> connections;
+  for(int c = 0; c < 4; ++c) connections.push_back(connection(loop, c * 10, 10));
+  for(const auto& c : connections) c.start();
+  const auto w = watchdog(loop);
+  w.start();
+  loop.run();
+
+  long sum = 0;
+  for(const auto& c : connections) sum += c.get_result();
+  std::cout << "=== suspension times (checksum " << sum << ") ===\n";
+  registry::print_histograms(std::cout);
+}
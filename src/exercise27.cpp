@@ -0,0 +1,593 @@
+// - Cancel a tree of running tasks with `std::stop_token`
+//   - the top-level task gets the token in `start()`
+//   - awaiting a task passes the token of the awaiting task to the awaited one
+//   - `co_await get_stop_token` gives the token of the current task
+// - Cancellable awaiters for sleeping and waiting for a file descriptor
+//   - a `std::stop_callback` deregisters the timer or the descriptor and schedules the coroutine
+//     right away, without waiting for the timer to expire or the descriptor to become ready
+//   - the awaiter then returns `false` (cancelled) instead of `true`
+//   - the stop may be requested from any thread
+//   - destroying the frame of a suspended coroutine deregisters its awaiter as well
+// - A cancelled tree unwinds immediately: its frames and timers are released at once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <concepts>
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+inline std::size_t live_frames = 0;
+
+// the promise of a coroutine that can be cancelled
+template<typename P>
+concept stoppable_promise = requires(const P& p) {
+  { p.get_stop_token() } noexcept -> std::same_as<std::stop_token>;
+};
+
+template<typename P>
+std::stop_token stop_token_of(std::coroutine_handle<P> h) noexcept
+{
+  if constexpr(stoppable_promise<P>)
+    return h.promise().get_stop_token();
+  else
+    return {};
+}
+
+struct stop_token_awaiter {
+  std::stop_token token;
+  static bool await_ready() noexcept { return false; }
+  template<typename P>
+  bool await_suspend(std::coroutine_handle<P> h) noexcept
+  {
+    token = stop_token_of(h);
+    return false;
+  }
+  std::stop_token await_resume() noexcept { return std::move(token); }
+};
+
+// `co_await get_stop_token` gives the stop token of the current coroutine
+inline constexpr struct get_stop_token_t {
+  stop_token_awaiter operator co_await() const noexcept { return {}; }
+} get_stop_token;
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return *result;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+
+  // counts the frames that are still allocated
+  static void* operator new(std::size_t size)
+  {
+    void* ptr = ::operator new(size);
+    ++live_frames;
+    return ptr;
+  }
+  static void operator delete(void* ptr, std::size_t size) noexcept
+  {
+    --live_frames;
+    ::operator delete(ptr, size);
+  }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::stop_token token;
+
+    [[nodiscard]] std::stop_token get_stop_token() const noexcept { return token; }
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+  };
+
+  // starts the task from a non-coroutine context; returns once it suspends for the first time
+  void start(std::stop_token token = {}) const
+  {
+    promise_->token = std::move(token);
+    std::coroutine_handle<promise_type>::from_promise(*promise_).resume();
+  }
+  [[nodiscard]] bool done() const noexcept
+  {
+    return std::coroutine_handle<promise_type>::from_promise(*promise_).done();
+  }
+
+  [[nodiscard]] decltype(auto) get_result() const &
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() &&
+  {
+    return std::move(*promise_).get();
+  }
+
+  auto operator co_await() const noexcept { return awaiter{promise_.get()}; }
+
+private:
+  struct awaiter {
+    promise_type* p_;
+    bool await_ready() const noexcept
+    {
+      return std::coroutine_handle<promise_type>::from_promise(*p_).done();
+    }
+    // the awaited task is cancelled together with the awaiting one
+    template<typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> caller) const noexcept
+    {
+      p_->token = stop_token_of(caller);
+      p_->continuation = caller;
+      return std::coroutine_handle<promise_type>::from_promise(*p_);
+    }
+    decltype(auto) await_resume() const { return std::move(*p_).get(); }
+  };
+
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* EVENT LOOP *********
+
+// single-threaded loop resuming coroutines when their timers expire, their file descriptors become
+// readable or they are cancelled; `request_stop()` may be called from any thread
+class event_loop {
+public:
+  using clock = std::chrono::steady_clock;
+
+  event_loop() : wake_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+  {
+    if(wake_fd_ < 0) throw std::system_error(errno, std::system_category(), "eventfd");
+  }
+  event_loop(const event_loop&) = delete;
+  event_loop& operator=(const event_loop&) = delete;
+  ~event_loop()
+  {
+    close(wake_fd_);
+  }
+
+private:
+  struct waiter;
+  using timer_map = std::multimap<clock::time_point, waiter*>;
+
+  struct waiter {
+    std::coroutine_handle<> handle;
+    bool pending = false;  // registered with the loop, guarded by `mutex_`
+    bool queued = false;   // woken up but not resumed yet, guarded by `mutex_`
+    bool cancelled = false;
+    timer_map::iterator timer;
+    int fd = -1;
+  };
+
+  // registers a waiter with the loop until it is woken up or cancelled
+  template<typename Derived>
+  class cancellable_awaiter : protected waiter {
+  public:
+    explicit cancellable_awaiter(event_loop& loop) noexcept : loop_(loop) {}
+    cancellable_awaiter(const cancellable_awaiter&) = delete;
+    cancellable_awaiter& operator=(const cancellable_awaiter&) = delete;
+    // the frame may be destroyed while suspended, e.g. a loser of `when_any()`; this has to happen on
+    // the loop thread, or while the loop is not running
+    ~cancellable_awaiter()
+    {
+      // waits for a stop callback running on another thread
+      on_stop_.reset();
+      loop_.forget(*this);
+    }
+
+    static bool await_ready() noexcept { return false; }
+    template<typename P>
+    bool await_suspend(std::coroutine_handle<P> h)
+    {
+      const auto token = stop_token_of(h);
+      if(token.stop_requested()) {
+        cancelled = true;
+        return false;
+      }
+      handle = h;
+      {
+        const std::scoped_lock lock(loop_.mutex_);
+        static_cast<Derived&>(*this).do_register();
+        pending = true;
+      }
+      // runs right away if the stop was requested in the meantime
+      on_stop_.emplace(token, stop_callback{this});
+      return true;
+    }
+    // `false` if cancelled
+    bool await_resume() noexcept
+    {
+      on_stop_.reset();
+      queued = false;
+      return !cancelled;
+    }
+
+  protected:
+    event_loop& loop_;
+
+  private:
+    struct stop_callback {
+      cancellable_awaiter* self;
+      void operator()() const noexcept { self->loop_.cancel(*self); }
+    };
+    std::optional<std::stop_callback<stop_callback>> on_stop_;
+  };
+
+public:
+  template<typename Rep, typename Period>
+  [[nodiscard]] auto sleep_for(std::chrono::duration<Rep, Period> d)
+  {
+    class awaiter : public cancellable_awaiter<awaiter> {
+    public:
+      awaiter(event_loop& loop, clock::time_point deadline) noexcept :
+          cancellable_awaiter<awaiter>(loop), deadline_(deadline)
+      {
+      }
+      void do_register() { this->timer = this->loop_.timers_.emplace(deadline_, static_cast<waiter*>(this)); }
+    private:
+      clock::time_point deadline_;
+    };
+    return awaiter(*this, clock::now() + d);
+  }
+
+  // one coroutine at a time may wait for a given descriptor
+  [[nodiscard]] auto readable(int fd)
+  {
+    class awaiter : public cancellable_awaiter<awaiter> {
+    public:
+      awaiter(event_loop& loop, int fd) noexcept : cancellable_awaiter<awaiter>(loop) { this->fd = fd; }
+      void do_register() { this->loop_.readers_.emplace(this->fd, static_cast<waiter*>(this)); }
+    };
+    return awaiter(*this, fd);
+  }
+
+  [[nodiscard]] std::size_t pending_waiters() const
+  {
+    const std::scoped_lock lock(mutex_);
+    return timers_.size() + readers_.size();
+  }
+
+  // runs until nothing waits on the loop
+  void run()
+  {
+    std::vector<pollfd> fds;
+    runner_.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    while(true) {
+      int timeout = -1;
+      fds.assign(1, {wake_fd_, POLLIN, 0});
+      {
+        const std::scoped_lock lock(mutex_);
+        const auto now = clock::now();
+        while(!timers_.empty() && timers_.begin()->first <= now) wake(*timers_.begin()->second);
+        if(ready_.empty() && timers_.empty() && readers_.empty()) {
+          runner_.store({}, std::memory_order_relaxed);
+          return;
+        }
+        resuming_.swap(ready_);
+        if(resuming_.empty() && !timers_.empty())
+          timeout = static_cast<int>(
+            std::chrono::ceil<std::chrono::milliseconds>(timers_.begin()->first - now).count());
+        for(const auto& [fd, w] : readers_) fds.push_back({fd, POLLIN, 0});
+      }
+
+      if(!resuming_.empty()) {
+        // a coroutine may destroy the frame of another one in the batch, which then clears its entry
+        for(std::size_t i = 0; i < resuming_.size(); ++i)
+          if(const auto h = std::exchange(resuming_[i], nullptr)) h.resume();
+        resuming_.clear();
+        continue;
+      }
+
+      if(poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR)
+        throw std::system_error(errno, std::system_category(), "poll");
+      if(fds[0].revents) {
+        std::uint64_t count;
+        while(read(wake_fd_, &count, sizeof(count)) > 0) {}
+        // a later `cancel()` writes again; one between the read and here only causes a spurious wake-up
+        wake_pending_.store(false, std::memory_order_release);
+      }
+      const std::scoped_lock lock(mutex_);
+      for(std::size_t i = 1; i < fds.size(); ++i)
+        if(fds[i].revents)
+          if(const auto it = readers_.find(fds[i].fd); it != readers_.end()) wake(*it->second);
+    }
+  }
+
+private:
+  // moves a registered waiter to the ready list; called with `mutex_` held
+  void wake(waiter& w)
+  {
+    if(w.fd >= 0)
+      readers_.erase(w.fd);
+    else
+      timers_.erase(w.timer);
+    w.pending = false;
+    w.queued = true;
+    ready_.push_back(w.handle);
+  }
+
+  // deregisters a waiter whose frame is destroyed before it was resumed
+  void forget(waiter& w) noexcept
+  {
+    const std::scoped_lock lock(mutex_);
+    if(w.pending) {
+      if(w.fd >= 0)
+        readers_.erase(w.fd);
+      else
+        timers_.erase(w.timer);
+      w.pending = false;
+    }
+    else if(w.queued) {
+      std::erase(ready_, w.handle);
+      std::replace(resuming_.begin(), resuming_.end(), w.handle, std::coroutine_handle<>());
+      w.queued = false;
+    }
+  }
+
+  void cancel(waiter& w) noexcept
+  {
+    {
+      const std::scoped_lock lock(mutex_);
+      if(!w.pending) return;
+      wake(w);
+      w.cancelled = true;
+    }
+    // the loop thread looks at the ready list before polling again; other threads wake it up once
+    if(std::this_thread::get_id() == runner_.load(std::memory_order_relaxed)) return;
+    if(wake_pending_.exchange(true, std::memory_order_acq_rel)) return;
+    const std::uint64_t one = 1;
+    static_cast<void>(write(wake_fd_, &one, sizeof(one)));
+  }
+
+  mutable std::mutex mutex_;
+  timer_map timers_;
+  std::unordered_map<int, waiter*> readers_;
+  std::vector<std::coroutine_handle<>> ready_;
+  std::vector<std::coroutine_handle<>> resuming_;  // used by the loop thread only
+  int wake_fd_;
+  std::atomic<bool> wake_pending_ = false;
+  std::atomic<std::thread::id> runner_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <iostream>
+
+using namespace std::chrono_literals;
+
+task<bool> backend(event_loop& loop, int id)
+{
+  const bool completed = co_await loop.sleep_for(10s);
+  std::cout << "  backend " << id << (completed ? " completed" : " cancelled") << "\n";
+  co_return completed;
+}
+
+// the children inherit the stop token without passing it around
+task<int> fan_out(event_loop& loop)
+{
+  const std::stop_token token = co_await get_stop_token;
+  int completed = 0;
+  for(int id = 0; id < 3 && !token.stop_requested(); ++id) completed += co_await backend(loop, id);
+  co_return completed;
+}
+
+task<void> handle_request(event_loop& loop, int fd)
+{
+  const bool request_arrived = co_await loop.readable(fd);
+  if(!request_arrived) {
+    std::cout << "  read cancelled\n";
+    co_return;
+  }
+  co_await fan_out(loop);
+}
+
+task<bool> sleeper(event_loop& loop)
+{
+  co_return co_await loop.sleep_for(10s);
+}
+
+task<void> deadline(event_loop& loop, std::stop_source& source, std::chrono::milliseconds timeout)
+{
+  static_cast<void>(co_await loop.sleep_for(timeout));
+  std::cout << "  deadline reached\n";
+  source.request_stop();
+}
+
+// reports what is left once the loop has nothing to wait for; only the frames of the top-level tasks remain
+void report(const event_loop& loop, std::chrono::steady_clock::time_point start)
+{
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << "  loop finished after " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()
+            << "ms, " << loop.pending_waiters() << " waiters and " << live_frames << " frames left\n";
+}
+
+int main()
+{
+  int fds[2];
+  if(pipe(fds) != 0) return 1;
+
+  // nothing is ever written to the pipe, another thread gives up on the read
+  std::cout << "read cancelled from another thread:\n";
+  {
+    event_loop loop;
+    std::stop_source source;
+    const auto start = std::chrono::steady_clock::now();
+    const auto t = handle_request(loop, fds[0]);
+    t.start(source.get_token());
+    std::jthread canceller([&] {
+      std::this_thread::sleep_for(30ms);
+      source.request_stop();
+    });
+    loop.run();
+    report(loop, start);
+  }
+
+  // the request arrives, its backends take too long
+  std::cout << "backends cancelled by a deadline:\n";
+  {
+    event_loop loop;
+    std::stop_source source;
+    static_cast<void>(write(fds[1], "x", 1));
+    const auto start = std::chrono::steady_clock::now();
+    const auto t = handle_request(loop, fds[0]);
+    t.start(source.get_token());
+    const auto d = deadline(loop, source, 50ms);
+    d.start();
+    loop.run();
+    report(loop, start);
+  }
+
+  // destroyed while waiting for its timer, and after being cancelled but before being resumed
+  std::cout << "suspended tasks destroyed:\n";
+  {
+    event_loop loop;
+    std::stop_source source;
+    const auto start = std::chrono::steady_clock::now();
+    {
+      const auto waiting = sleeper(loop);
+      waiting.start();
+      const auto cancelled = sleeper(loop);
+      cancelled.start(source.get_token());
+      source.request_stop();
+    }
+    loop.run();
+    report(loop, start);
+  }
+
+  // each cancellation from another thread used to write to a pipe, which blocked once its buffer was full
+  constexpr int sleepers = 100'000;
+  std::cout << sleepers << " sleepers cancelled from another thread:\n";
+  {
+    event_loop loop;
+    std::stop_source source;
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<task<bool>> tasks;
+    tasks.reserve(sleepers);
+    for(int i = 0; i < sleepers; ++i) {
+      tasks.push_back(sleeper(loop));
+      tasks.back().start(source.get_token());
+    }
+    std::jthread canceller([&] {
+      std::this_thread::sleep_for(30ms);
+      source.request_stop();
+    });
+    loop.run();
+    report(loop, start);
+  }
+
+  close(fds[0]);
+  close(fds[1]);
+}
@@ -0,0 +1,620 @@
+// - Synchronize `task<T>` coroutines without blocking the threads they run on
+//   - `async_mutex`: `co_await m.scoped_lock()` gives a guard that unlocks when destroyed, waiters
+//     acquire the mutex in FIFO order
+//   - `async_semaphore`: `co_await s.acquire()` takes a permit, `s.release()` gives it back
+//   - `async_manual_reset_event`: `co_await e` waits until `e.set()` is called
+// - The waiters are intrusive lists of awaiters, which live in the frames of the waiting coroutines
+//   - the lists are updated with atomic compare-and-swap only, waiting never allocates nor parks a
+//     thread
+//   - the uncontended lock and unlock, or acquire and release, cost a single CAS each
+//   - the waiters are resumed inline on the thread that unlocks, releases or sets
+
+#include <atomic>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <utility>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return *result;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+  };
+
+  [[nodiscard]] decltype(auto) get_result() const &
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() const &&
+  {
+    return std::move(promise_)->get();
+  }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      bool await_ready() const noexcept
+      {
+        return std::coroutine_handle<promise_type>::from_promise(*p_).done();
+      }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        p_->continuation = caller;
+        return std::coroutine_handle<promise_type>::from_promise(*p_);
+      }
+      decltype(auto) await_resume() const { return std::move(*p_).get(); }
+    };
+    return awaiter{promise_.get()};
+  }
+
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* MUTEX *********
+
+class async_mutex_lock;
+
+class async_mutex {
+public:
+  async_mutex() noexcept = default;
+  async_mutex(const async_mutex&) = delete;
+  async_mutex& operator=(const async_mutex&) = delete;
+
+  class lock_awaiter {
+  public:
+    explicit lock_awaiter(async_mutex& m) noexcept : mutex_(m) {}
+    bool await_ready() noexcept { return mutex_.try_lock(); }
+    bool await_suspend(std::coroutine_handle<> h) noexcept
+    {
+      handle_ = h;
+      auto state = mutex_.state_.load(std::memory_order_relaxed);
+      while(true) {
+        if(state == not_locked) {
+          if(mutex_.state_.compare_exchange_weak(state, locked_no_waiters, std::memory_order_acquire,
+                                                 std::memory_order_relaxed))
+            return false;
+        }
+        else {
+          next_ = state == locked_no_waiters ? nullptr : reinterpret_cast<lock_awaiter*>(state);
+          if(mutex_.state_.compare_exchange_weak(state, reinterpret_cast<std::uintptr_t>(this),
+                                                 std::memory_order_release, std::memory_order_relaxed))
+            return true;
+        }
+      }
+    }
+    static void await_resume() noexcept {}
+
+  protected:
+    async_mutex& mutex_;
+
+  private:
+    friend class async_mutex;
+    std::coroutine_handle<> handle_;
+    lock_awaiter* next_ = nullptr;
+  };
+
+  class scoped_lock_awaiter : public lock_awaiter {
+  public:
+    using lock_awaiter::lock_awaiter;
+    [[nodiscard]] async_mutex_lock await_resume() const noexcept;
+  };
+
+  [[nodiscard]] bool try_lock() noexcept
+  {
+    auto expected = not_locked;
+    return state_.compare_exchange_strong(expected, locked_no_waiters, std::memory_order_acquire,
+                                          std::memory_order_relaxed);
+  }
+  // `co_await m.lock_async()` locks the mutex, `m.unlock()` has to be called afterwards
+  [[nodiscard]] lock_awaiter lock_async() noexcept { return lock_awaiter(*this); }
+  // `co_await m.scoped_lock()` locks the mutex and gives a guard that unlocks it
+  [[nodiscard]] scoped_lock_awaiter scoped_lock() noexcept { return scoped_lock_awaiter(*this); }
+
+  // hands the mutex over to the next waiter, if any, and resumes it
+  void unlock() noexcept
+  {
+    auto* head = waiters_;
+    if(!head) {
+      auto expected = locked_no_waiters;
+      if(state_.compare_exchange_strong(expected, not_locked, std::memory_order_release, std::memory_order_relaxed))
+        return;
+      // take the waiters that arrived since, most recent first, and reverse them into FIFO order
+      auto* waiter = reinterpret_cast<lock_awaiter*>(state_.exchange(locked_no_waiters, std::memory_order_acquire));
+      while(waiter) {
+        auto* next = waiter->next_;
+        waiter->next_ = head;
+        head = waiter;
+        waiter = next;
+      }
+    }
+    waiters_ = head->next_;
+    head->handle_.resume();
+  }
+
+private:
+  // `not_locked`, `locked_no_waiters` or the last waiter that arrived
+  static constexpr std::uintptr_t not_locked = 1;
+  static constexpr std::uintptr_t locked_no_waiters = 0;
+  std::atomic<std::uintptr_t> state_ = not_locked;
+  // waiters in FIFO order, only accessed by the owner of the mutex
+  lock_awaiter* waiters_ = nullptr;
+};
+
+// unlocks the mutex when destroyed
+class [[nodiscard]] async_mutex_lock {
+public:
+  explicit async_mutex_lock(async_mutex& m) noexcept : mutex_(&m) {}
+  async_mutex_lock(async_mutex_lock&& other) noexcept : mutex_(std::exchange(other.mutex_, nullptr)) {}
+  async_mutex_lock& operator=(async_mutex_lock&&) = delete;
+  ~async_mutex_lock()
+  {
+    if(mutex_) mutex_->unlock();
+  }
+
+private:
+  async_mutex* mutex_;
+};
+
+inline async_mutex_lock async_mutex::scoped_lock_awaiter::await_resume() const noexcept
+{
+  return async_mutex_lock(mutex_);
+}
+
+
+// ********* SEMAPHORE *********
+
+// waiters are resumed in no particular order
+class async_semaphore {
+public:
+  explicit async_semaphore(std::size_t permits) noexcept : state_(encode(permits)) {}
+  async_semaphore(const async_semaphore&) = delete;
+  async_semaphore& operator=(const async_semaphore&) = delete;
+
+  class acquire_awaiter {
+  public:
+    explicit acquire_awaiter(async_semaphore& s) noexcept : semaphore_(s) {}
+    bool await_ready() noexcept { return semaphore_.try_acquire(); }
+    bool await_suspend(std::coroutine_handle<> h) noexcept
+    {
+      handle_ = h;
+      auto state = semaphore_.state_.load(std::memory_order_relaxed);
+      while(true) {
+        if(is_permits(state) && state != no_permits) {
+          if(semaphore_.state_.compare_exchange_weak(state, state - 2, std::memory_order_acquire,
+                                                     std::memory_order_relaxed))
+            return false;
+        }
+        else {
+          next_ = state == no_permits ? nullptr : reinterpret_cast<acquire_awaiter*>(state);
+          if(semaphore_.state_.compare_exchange_weak(state, reinterpret_cast<std::uintptr_t>(this),
+                                                     std::memory_order_release, std::memory_order_relaxed))
+            return true;
+        }
+      }
+    }
+    // the permit was handed over by `release()`
+    static void await_resume() noexcept {}
+
+  private:
+    friend class async_semaphore;
+    async_semaphore& semaphore_;
+    std::coroutine_handle<> handle_;
+    acquire_awaiter* next_ = nullptr;
+  };
+
+  [[nodiscard]] bool try_acquire() noexcept
+  {
+    auto state = state_.load(std::memory_order_relaxed);
+    while(is_permits(state) && state != no_permits)
+      if(state_.compare_exchange_weak(state, state - 2, std::memory_order_acquire, std::memory_order_relaxed))
+        return true;
+    return false;
+  }
+  [[nodiscard]] acquire_awaiter acquire() noexcept { return acquire_awaiter(*this); }
+
+  // gives a permit back, or hands it over to a waiter and resumes it
+  void release() noexcept
+  {
+    auto state = state_.load(std::memory_order_relaxed);
+    while(true) {
+      if(is_permits(state)) {
+        if(state_.compare_exchange_weak(state, state + 2, std::memory_order_release, std::memory_order_relaxed))
+          return;
+      }
+      // take all the waiters, no other thread can touch them anymore
+      else if(state_.compare_exchange_weak(state, no_permits, std::memory_order_acquire, std::memory_order_relaxed))
+        break;
+    }
+
+    auto* waiters = reinterpret_cast<acquire_awaiter*>(state);
+    auto* resumed = waiters;
+    waiters = waiters->next_;
+    resumed->next_ = nullptr;
+
+    // give the rest back, handing them the permits released in the meantime; `last->next_` is linked
+    // to the waiters that arrived in the meantime only for the attempt to put the list back
+    auto* last = waiters;
+    while(last && last->next_) last = last->next_;
+    while(waiters) {
+      state = state_.load(std::memory_order_relaxed);
+      if(is_permits(state) && state != no_permits) {
+        if(state_.compare_exchange_weak(state, state - 2, std::memory_order_acquire, std::memory_order_relaxed)) {
+          auto* next = waiters->next_;
+          waiters->next_ = resumed;
+          resumed = waiters;
+          waiters = next;
+        }
+        continue;
+      }
+      last->next_ = state == no_permits ? nullptr : reinterpret_cast<acquire_awaiter*>(state);
+      if(state_.compare_exchange_weak(state, reinterpret_cast<std::uintptr_t>(waiters), std::memory_order_release,
+                                      std::memory_order_relaxed))
+        break;
+      last->next_ = nullptr;
+    }
+
+    while(resumed) {
+      auto* next = resumed->next_;
+      resumed->handle_.resume();
+      resumed = next;
+    }
+  }
+
+private:
+  // the number of available permits `n` is stored as `2n + 1`, waiters are stored as the pointer to
+  // the last one that arrived, which is always even
+  static constexpr std::uintptr_t encode(std::size_t permits) noexcept { return permits << 1 | 1; }
+  static constexpr bool is_permits(std::uintptr_t state) noexcept { return state & 1; }
+  static constexpr std::uintptr_t no_permits = 1;
+
+  std::atomic<std::uintptr_t> state_;
+};
+
+
+// ********* EVENT *********
+
+class async_manual_reset_event {
+public:
+  explicit async_manual_reset_event(bool set = false) noexcept : state_(set ? this : nullptr) {}
+  async_manual_reset_event(const async_manual_reset_event&) = delete;
+  async_manual_reset_event& operator=(const async_manual_reset_event&) = delete;
+
+  class awaiter {
+  public:
+    explicit awaiter(async_manual_reset_event& e) noexcept : event_(e) {}
+    bool await_ready() const noexcept { return event_.is_set(); }
+    bool await_suspend(std::coroutine_handle<> h) noexcept
+    {
+      handle_ = h;
+      void* state = event_.state_.load(std::memory_order_acquire);
+      do {
+        if(state == &event_) return false;
+        next_ = static_cast<awaiter*>(state);
+      } while(!event_.state_.compare_exchange_weak(state, this, std::memory_order_release, std::memory_order_acquire));
+      return true;
+    }
+    static void await_resume() noexcept {}
+
+  private:
+    friend class async_manual_reset_event;
+    async_manual_reset_event& event_;
+    std::coroutine_handle<> handle_;
+    awaiter* next_ = nullptr;
+  };
+
+  [[nodiscard]] bool is_set() const noexcept { return state_.load(std::memory_order_acquire) == this; }
+
+  // resumes all the waiters
+  void set() noexcept
+  {
+    void* state = state_.exchange(this, std::memory_order_acq_rel);
+    if(state == this) return;
+    for(auto* waiter = static_cast<awaiter*>(state); waiter;) {
+      auto* next = waiter->next_;
+      waiter->handle_.resume();
+      waiter = next;
+    }
+  }
+  void reset() noexcept
+  {
+    void* expected = this;
+    state_.compare_exchange_strong(expected, nullptr, std::memory_order_relaxed);
+  }
+
+  awaiter operator co_await() noexcept { return awaiter(*this); }
+
+private:
+  // `this` when set, otherwise the last waiter that arrived or `nullptr`
+  std::atomic<void*> state_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <chrono>
+#include <iostream>
+#include <latch>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fire-and-forget coroutine used to start a task and signal its completion
+struct detached {
+  struct promise_type {
+    static std::suspend_never initial_suspend() noexcept { return {}; }
+    static std::suspend_never final_suspend() noexcept { return {}; }
+    static detached get_return_object() noexcept { return {}; }
+    static void return_void() noexcept {}
+    [[noreturn]] static void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+template<typename T>
+detached spawn(task<T> t, std::latch& done)
+{
+  co_await t;
+  done.count_down();
+}
+
+// the increments of coroutines resumed on different threads are serialized by the mutex
+task<void> increment(async_mutex& mutex, long& counter, int times)
+{
+  for(int i = 0; i < times; ++i) {
+    const auto lock = co_await mutex.scoped_lock();
+    ++counter;
+  }
+}
+
+struct concurrency {
+  std::atomic<int> current = 0;
+  std::atomic<int> max = 0;
+  void enter() noexcept
+  {
+    const int now = ++current;
+    int prev = max.load();
+    while(prev < now && !max.compare_exchange_weak(prev, now)) {}
+  }
+  void leave() noexcept { --current; }
+};
+
+// holds a permit while waiting for the event
+task<void> limited(async_semaphore& semaphore, async_manual_reset_event& event, concurrency& c)
+{
+  co_await semaphore.acquire();
+  c.enter();
+  co_await event;
+  c.leave();
+  semaphore.release();
+}
+
+task<void> limited_loop(async_semaphore& semaphore, concurrency& c, int times)
+{
+  for(int i = 0; i < times; ++i) {
+    co_await semaphore.acquire();
+    c.enter();
+    c.leave();
+    semaphore.release();
+  }
+}
+
+task<void> acquire_once(async_semaphore& semaphore, std::atomic<int>& acquired)
+{
+  co_await semaphore.acquire();
+  ++acquired;
+}
+
+template<typename F>
+void bench(const char* name, F op)
+{
+  constexpr int iterations = 1'000'000;
+  const auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < iterations; ++i) op();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << name << ": " << std::chrono::duration<double, std::nano>(elapsed).count() / iterations
+            << " ns per lock and unlock\n";
+}
+
+int main()
+{
+  constexpr int threads = 4;
+  constexpr int tasks_per_thread = 50;
+  constexpr int times = 2'000;
+
+  // the coroutines waiting for the mutex are resumed by whichever thread unlocks it
+  {
+    async_mutex mutex;
+    long counter = 0;
+    std::latch done(threads * tasks_per_thread);
+    std::vector<std::jthread> workers;
+    for(int t = 0; t < threads; ++t)
+      workers.emplace_back([&] {
+        for(int i = 0; i < tasks_per_thread; ++i) spawn(increment(mutex, counter, times), done);
+      });
+    done.wait();
+    std::cout << "mutex: counter " << counter << ", expected " << threads * tasks_per_thread * times << "\n";
+  }
+
+  // 3 coroutines get a permit and wait for the event, the others wait for a permit
+  {
+    async_semaphore semaphore(3);
+    async_manual_reset_event event;
+    concurrency c;
+    std::latch done(10);
+    for(int i = 0; i < 10; ++i) spawn(limited(semaphore, event, c), done);
+    std::cout << "semaphore: " << c.current << " holding a permit before the event is set\n";
+    event.set();
+    done.wait();
+    std::cout << "semaphore: at most " << c.max << " held a permit at once\n";
+  }
+
+  {
+    async_semaphore semaphore(2);
+    concurrency c;
+    std::latch done(threads * tasks_per_thread);
+    std::vector<std::jthread> workers;
+    for(int t = 0; t < threads; ++t)
+      workers.emplace_back([&] {
+        for(int i = 0; i < tasks_per_thread; ++i) spawn(limited_loop(semaphore, c, times), done);
+      });
+    done.wait();
+    std::cout << "semaphore across threads: at most " << c.max << " held a permit at once, limit 2\n";
+  }
+
+  // a single permit, acquiring and releasing threads race on the list of waiters
+  {
+    constexpr int acquirers = threads * 20'000;
+    async_semaphore semaphore(1);
+    std::atomic<int> acquired = 0;
+    std::latch done(acquirers);
+    std::vector<std::jthread> workers;
+    for(int t = 0; t < threads; ++t) {
+      workers.emplace_back([&] {
+        for(int i = 0; i < acquirers / threads; ++i) spawn(acquire_once(semaphore, acquired), done);
+      });
+      workers.emplace_back([&] {
+        for(int i = 0; i < acquirers / threads; ++i) semaphore.release();
+      });
+    }
+    done.wait();
+    workers.clear();
+    const bool one_left = semaphore.try_acquire() && !semaphore.try_acquire();
+    std::cout << "semaphore stress: " << acquired << " of " << acquirers << " acquired, "
+              << (one_left ? "1 permit left" : "wrong number of permits left") << "\n";
+  }
+
+  // the cost of the uncontended path
+  {
+    async_mutex mutex;
+    std::mutex std_mutex;
+    long counter = 0;
+    bench("async_mutex try_lock()", [&] {
+      if(mutex.try_lock()) {
+        ++counter;
+        mutex.unlock();
+      }
+    });
+    bench("std::mutex            ", [&] {
+      const std::scoped_lock lock(std_mutex);
+      ++counter;
+    });
+    constexpr int iterations = 1'000'000;
+    const auto start = std::chrono::steady_clock::now();
+    std::latch done(1);
+    spawn(increment(mutex, counter, iterations), done);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "co_await scoped_lock(): " << std::chrono::duration<double, std::nano>(elapsed).count() / iterations
+              << " ns per lock and unlock\n";
+  }
+}
@@ -0,0 +1,596 @@
+// - Hand values between coroutines running on different threads with a bounded `channel<T>`
+//   - a lock-free ring buffer of sequence-numbered slots (Dmitry Vyukov's bounded MPMC queue)
+//   - `co_await ch.send(v)` suspends only while the channel is full and gives `false` once the
+//     channel is closed
+//   - `co_await ch.recv()` suspends only while the channel is empty and gives `std::nullopt` once
+//     the channel is closed and drained
+//   - `try_send()` and `try_recv()` never suspend
+// - Waiting coroutines are parked in intrusive lists of awaiters
+//   - a sender that fills an empty slot hands a value to a parked receiver and resumes it inline, a
+//     receiver that frees a slot hands it to a parked sender
+//   - the lists are guarded by a mutex, which is only taken when somebody is parked: both sides
+//     check an atomic count of parked coroutines after each operation
+// - `close()` resumes every parked coroutine
+// - Compare the throughput with a queue guarded by a `std::mutex`
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <thread>
+#include <utility>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return *result;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+  };
+
+  [[nodiscard]] decltype(auto) get_result() const &
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() const &&
+  {
+    return std::move(promise_)->get();
+  }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      bool await_ready() const noexcept
+      {
+        return std::coroutine_handle<promise_type>::from_promise(*p_).done();
+      }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        p_->continuation = caller;
+        return std::coroutine_handle<promise_type>::from_promise(*p_);
+      }
+      decltype(auto) await_resume() const { return std::move(*p_).get(); }
+    };
+    return awaiter{promise_.get()};
+  }
+
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* CHANNEL *********
+
+template<std::movable T>
+class channel {
+  struct waiter {
+    std::coroutine_handle<> handle;
+    waiter* next = nullptr;
+  };
+
+  // FIFO list of parked awaiters, guarded by `mutex_`
+  template<typename Awaiter>
+  struct waiter_list {
+    Awaiter* head = nullptr;
+    Awaiter* tail = nullptr;
+    void push(Awaiter& w) noexcept
+    {
+      w.next = nullptr;
+      if(tail)
+        tail->next = &w;
+      else
+        head = &w;
+      tail = &w;
+    }
+    Awaiter* pop() noexcept
+    {
+      auto* w = head;
+      head = static_cast<Awaiter*>(w->next);
+      if(!head) tail = nullptr;
+      return w;
+    }
+    [[nodiscard]] bool empty() const noexcept { return !head; }
+  };
+
+public:
+  // the capacity is rounded up to a power of two
+  explicit channel(std::size_t capacity) :
+      mask_(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1), cells_(new cell[mask_ + 1])
+  {
+    for(std::size_t i = 0; i <= mask_; ++i) cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  channel(const channel&) = delete;
+  channel& operator=(const channel&) = delete;
+  ~channel()
+  {
+    while(pop()) {}
+  }
+
+  class [[nodiscard]] send_awaiter : waiter {
+  public:
+    send_awaiter(channel& ch, T value) noexcept(std::is_nothrow_move_constructible_v<T>) :
+        channel_(ch), value_(std::move(value))
+    {
+    }
+    bool await_ready()
+    {
+      if(channel_.closed_.load(std::memory_order_acquire)) return true;
+      sent_ = channel_.try_send(std::move(value_));
+      return sent_;
+    }
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+      this->handle = h;
+      return channel_.park(*this);
+    }
+    // `false` if the channel was closed
+    [[nodiscard]] bool await_resume() const noexcept { return sent_; }
+
+  private:
+    friend class channel;
+    channel& channel_;
+    T value_;
+    bool sent_ = false;
+  };
+
+  class [[nodiscard]] recv_awaiter : waiter {
+  public:
+    explicit recv_awaiter(channel& ch) noexcept : channel_(ch) {}
+    bool await_ready()
+    {
+      value_ = channel_.try_recv();
+      return value_ || channel_.closed_.load(std::memory_order_acquire);
+    }
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+      this->handle = h;
+      return channel_.park(*this);
+    }
+    // `std::nullopt` if the channel was closed and drained
+    std::optional<T> await_resume()
+    {
+      if(!value_) value_ = channel_.try_recv();
+      return std::move(value_);
+    }
+
+  private:
+    friend class channel;
+    channel& channel_;
+    std::optional<T> value_;
+  };
+
+  send_awaiter send(T value) noexcept(std::is_nothrow_move_constructible_v<T>) { return {*this, std::move(value)}; }
+  recv_awaiter recv() noexcept { return recv_awaiter(*this); }
+
+  // moves from `value` only if it was sent, fails once the channel is closed
+  template<std::convertible_to<T> U>
+  [[nodiscard]] bool try_send(U&& value)
+  {
+    if(!push(std::forward<U>(value))) return false;
+    if(parked_receivers_.load(std::memory_order_seq_cst) != 0) wake_receiver();
+    return true;
+  }
+  [[nodiscard]] std::optional<T> try_recv()
+  {
+    auto value = pop();
+    if(value && parked_senders_.load(std::memory_order_seq_cst) != 0) wake_sender();
+    return value;
+  }
+
+  // fails the parked and future sends, the receivers get the values left before getting `std::nullopt`
+  void close()
+  {
+    // no send succeeds from here on, the ones that got a slot before are published before the
+    // receivers can see the channel as closed
+    const auto end = enqueue_pos_.fetch_or(closed_bit, std::memory_order_seq_cst) >> 1;
+    for(auto pos = end > mask_ ? end - mask_ - 1 : 0; pos < end; ++pos)
+      while(static_cast<std::intptr_t>(cells_[pos & mask_].sequence.load(std::memory_order_seq_cst) - (pos + 1)) < 0)
+        std::this_thread::yield();
+    closed_.store(true, std::memory_order_seq_cst);
+    waiter_list<send_awaiter> senders;
+    waiter_list<recv_awaiter> receivers;
+    {
+      const std::scoped_lock lock(mutex_);
+      senders = std::exchange(senders_, {});
+      receivers = std::exchange(receivers_, {});
+      parked_senders_.store(0, std::memory_order_relaxed);
+      parked_receivers_.store(0, std::memory_order_relaxed);
+    }
+    while(!senders.empty()) senders.pop()->handle.resume();
+    while(!receivers.empty()) receivers.pop()->handle.resume();
+  }
+  [[nodiscard]] bool closed() const noexcept { return closed_.load(std::memory_order_acquire); }
+
+private:
+  struct cell {
+    std::atomic<std::size_t> sequence;
+    alignas(T) std::byte storage[sizeof(T)];
+  };
+
+  // the slot at `pos` is free when its sequence is `pos`, and full when it is `pos + 1`; the stores
+  // that publish a slot and the loads of the parked counts are sequentially consistent, so either a
+  // parking coroutine sees the slot or the other side sees the parked coroutine
+  // - the enqueue position is stored shifted left by one, its lowest bit is set by `close()`, so a
+  //   push either takes its slot before the channel is closed or fails
+  template<typename U>
+  bool push(U&& value)
+  {
+    auto state = enqueue_pos_.load(std::memory_order_relaxed);
+    std::size_t pos;
+    cell* c;
+    while(true) {
+      if(state & closed_bit) return false;
+      pos = state >> 1;
+      c = &cells_[pos & mask_];
+      const auto diff = static_cast<std::intptr_t>(c->sequence.load(std::memory_order_seq_cst) - pos);
+      if(diff == 0) {
+        if(enqueue_pos_.compare_exchange_weak(state, (pos + 1) << 1, std::memory_order_relaxed)) break;
+      }
+      else if(diff < 0)
+        return false;
+      else
+        state = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+    ::new(static_cast<void*>(c->storage)) T(std::forward<U>(value));
+    c->sequence.store(pos + 1, std::memory_order_seq_cst);
+    return true;
+  }
+
+  std::optional<T> pop()
+  {
+    auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+    cell* c;
+    while(true) {
+      c = &cells_[pos & mask_];
+      const auto diff = static_cast<std::intptr_t>(c->sequence.load(std::memory_order_seq_cst) - (pos + 1));
+      if(diff == 0) {
+        if(dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      }
+      else if(diff < 0)
+        return std::nullopt;
+      else
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+    }
+    auto* ptr = std::launder(reinterpret_cast<T*>(c->storage));
+    std::optional<T> value(std::move(*ptr));
+    ptr->~T();
+    c->sequence.store(pos + mask_ + 1, std::memory_order_seq_cst);
+    return value;
+  }
+
+  // returns `false` if the send completed or failed meanwhile and the sender must not suspend
+  bool park(send_awaiter& w)
+  {
+    {
+      const std::scoped_lock lock(mutex_);
+      parked_senders_.fetch_add(1, std::memory_order_seq_cst);
+      if(!closed_.load(std::memory_order_relaxed) && !(w.sent_ = push(std::move(w.value_)))) {
+        senders_.push(w);
+        return true;
+      }
+      parked_senders_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    if(w.sent_ && parked_receivers_.load(std::memory_order_seq_cst) != 0) wake_receiver();
+    return false;
+  }
+
+  bool park(recv_awaiter& w)
+  {
+    {
+      const std::scoped_lock lock(mutex_);
+      parked_receivers_.fetch_add(1, std::memory_order_seq_cst);
+      if(!(w.value_ = pop()) && !closed_.load(std::memory_order_relaxed)) {
+        receivers_.push(w);
+        return true;
+      }
+      parked_receivers_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    if(w.value_ && parked_senders_.load(std::memory_order_seq_cst) != 0) wake_sender();
+    return false;
+  }
+
+  // gives a value to the first parked receiver, unless another receiver took it already
+  void wake_receiver()
+  {
+    recv_awaiter* w = nullptr;
+    {
+      const std::scoped_lock lock(mutex_);
+      if(receivers_.empty()) return;
+      auto value = pop();
+      if(!value) return;
+      w = receivers_.pop();
+      w->value_ = std::move(value);
+      parked_receivers_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    // the value freed a slot
+    if(parked_senders_.load(std::memory_order_seq_cst) != 0) wake_sender();
+    w->handle.resume();
+  }
+
+  // sends the value of the first parked sender, unless another sender took the free slot already
+  void wake_sender()
+  {
+    send_awaiter* w = nullptr;
+    {
+      const std::scoped_lock lock(mutex_);
+      if(senders_.empty() || !push(std::move(senders_.head->value_))) return;
+      w = senders_.pop();
+      w->sent_ = true;
+      parked_senders_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    if(parked_receivers_.load(std::memory_order_seq_cst) != 0) wake_receiver();
+    w->handle.resume();
+  }
+
+  static constexpr std::size_t closed_bit = 1;
+
+  const std::size_t mask_;
+  const std::unique_ptr<cell[]> cells_;
+  alignas(64) std::atomic<std::size_t> enqueue_pos_ = 0;
+  alignas(64) std::atomic<std::size_t> dequeue_pos_ = 0;
+  alignas(64) std::atomic<std::size_t> parked_senders_ = 0;
+  std::atomic<std::size_t> parked_receivers_ = 0;
+  std::atomic<bool> closed_ = false;  // set once the sends that got a slot are published
+  std::mutex mutex_;
+  waiter_list<send_awaiter> senders_;
+  waiter_list<recv_awaiter> receivers_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <latch>
+#include <thread>
+#include <vector>
+
+// fire-and-forget coroutine used to start a task and signal its completion
+struct detached {
+  struct promise_type {
+    static std::suspend_never initial_suspend() noexcept { return {}; }
+    static std::suspend_never final_suspend() noexcept { return {}; }
+    static detached get_return_object() noexcept { return {}; }
+    static void return_void() noexcept {}
+    [[noreturn]] static void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+template<typename T>
+detached spawn(task<T> t, std::latch& done)
+{
+  co_await t;
+  done.count_down();
+}
+
+task<void> produce(channel<long>& ch, long first, long count)
+{
+  for(long i = first; i < first + count; ++i) {
+    const bool sent = co_await ch.send(i);
+    if(!sent) co_return;
+  }
+}
+
+task<void> consume(channel<long>& ch, std::atomic<long>& sum)
+{
+  long local = 0;
+  while(true) {
+    const auto value = co_await ch.recv();
+    if(!value) break;
+    local += *value;
+  }
+  sum += local;
+}
+
+task<void> print_all(channel<std::string>& ch)
+{
+  while(true) {
+    const auto line = co_await ch.recv();
+    if(!line) break;
+    std::cout << "  received " << *line << "\n";
+  }
+  std::cout << "  channel closed\n";
+}
+
+// what we had: a bounded queue guarded by a `std::mutex`, blocking the threads
+class blocking_queue {
+public:
+  explicit blocking_queue(std::size_t capacity) : capacity_(capacity) {}
+  void push(long value)
+  {
+    std::unique_lock lock(mutex_);
+    not_full_.wait(lock, [&] { return queue_.size() < capacity_; });
+    queue_.push_back(value);
+    not_empty_.notify_one();
+  }
+  long pop()
+  {
+    std::unique_lock lock(mutex_);
+    not_empty_.wait(lock, [&] { return !queue_.empty(); });
+    const long value = queue_.front();
+    queue_.pop_front();
+    not_full_.notify_one();
+    return value;
+  }
+private:
+  std::size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<long> queue_;
+};
+
+constexpr std::size_t capacity = 1024;
+constexpr long messages = 10'000'000;
+
+void report(const char* name, std::chrono::steady_clock::duration elapsed, long sum)
+{
+  const auto seconds = std::chrono::duration<double>(elapsed).count();
+  const bool ok = sum == messages * (messages - 1) / 2;
+  std::cout << name << ": " << messages / seconds / 1e6 << "M messages/s" << (ok ? "" : " (wrong sum)") << "\n";
+}
+
+void bench_channel(const char* name, int producers, int consumers)
+{
+  channel<long> ch(capacity);
+  std::atomic<long> sum = 0;
+  std::latch produced(producers);
+  std::latch consumed(consumers);
+  const auto start = std::chrono::steady_clock::now();
+  {
+    std::vector<std::jthread> threads;
+    for(int c = 0; c < consumers; ++c) threads.emplace_back([&] { spawn(consume(ch, sum), consumed); });
+    for(int p = 0; p < producers; ++p)
+      threads.emplace_back([&, p] {
+        spawn(produce(ch, messages / producers * p, messages / producers), produced);
+      });
+  }
+  produced.wait();
+  ch.close();
+  consumed.wait();
+  report(name, std::chrono::steady_clock::now() - start, sum);
+}
+
+int main()
+{
+  std::cout << "close():\n";
+  {
+    channel<std::string> ch(4);
+    std::latch done(1);
+    spawn(print_all(ch), done);
+    for(const char* word : {"one", "two", "three"}) static_cast<void>(ch.try_send(std::string(word)));
+    ch.close();
+    done.wait();
+    std::cout << "  try_send() after close(): " << (ch.try_send(std::string("four")) ? "sent" : "failed") << "\n";
+  }
+
+  bench_channel("channel, 1 producer, 1 consumer  ", 1, 1);
+  bench_channel("channel, 2 producers, 2 consumers", 2, 2);
+
+  {
+    blocking_queue queue(capacity);
+    long sum = 0;
+    const auto start = std::chrono::steady_clock::now();
+    {
+      std::jthread consumer([&] {
+        for(long i = 0; i < messages; ++i) sum += queue.pop();
+      });
+      for(long i = 0; i < messages; ++i) queue.push(i);
+    }
+    report("std::mutex queue, 1 producer, 1 consumer", std::chrono::steady_clock::now() - start, sum);
+  }
+}
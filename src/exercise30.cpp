@@ -0,0 +1,675 @@
+// - `co_await with_timeout(loop, t, 5ms)` awaits the task `t` for at most 5 ms and gives a
+//   `std::expected<T, timeout_error>`
+//   - the task races a timer of the event loop, nothing blocks the thread
+//   - if the task finishes first, the timer is deregistered right away
+//   - if the timer expires first, the task is cancelled through its stop token: its cancellable
+//     awaiters resume it at once, so it unwinds and its frame is released on the next iteration of
+//     the loop instead of running to completion
+//   - the task is also cancelled together with the awaiting coroutine
+// - Event loop timers can run a callback instead of resuming a coroutine
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <concepts>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <expected>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+inline std::size_t live_frames = 0;
+
+// the promise of a coroutine that can be cancelled
+template<typename P>
+concept stoppable_promise = requires(const P& p) {
+  { p.get_stop_token() } noexcept -> std::same_as<std::stop_token>;
+};
+
+template<typename P>
+std::stop_token stop_token_of(std::coroutine_handle<P> h) noexcept
+{
+  if constexpr(stoppable_promise<P>)
+    return h.promise().get_stop_token();
+  else
+    return {};
+}
+
+struct stop_token_awaiter {
+  std::stop_token token;
+  static bool await_ready() noexcept { return false; }
+  template<typename P>
+  bool await_suspend(std::coroutine_handle<P> h) noexcept
+  {
+    token = stop_token_of(h);
+    return false;
+  }
+  std::stop_token await_resume() noexcept { return std::move(token); }
+};
+
+// `co_await get_stop_token` gives the stop token of the current coroutine
+inline constexpr struct get_stop_token_t {
+  stop_token_awaiter operator co_await() const noexcept { return {}; }
+} get_stop_token;
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return *result;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+
+  // counts the frames that are still allocated
+  static void* operator new(std::size_t size)
+  {
+    void* ptr = ::operator new(size);
+    ++live_frames;
+    return ptr;
+  }
+  static void operator delete(void* ptr, std::size_t size) noexcept
+  {
+    --live_frames;
+    ::operator delete(ptr, size);
+  }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::stop_token token;
+
+    [[nodiscard]] std::stop_token get_stop_token() const noexcept { return token; }
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+  };
+
+  // starts the task from a non-coroutine context; returns once it suspends for the first time
+  void start(std::stop_token token = {}) const
+  {
+    promise_->token = std::move(token);
+    std::coroutine_handle<promise_type>::from_promise(*promise_).resume();
+  }
+  [[nodiscard]] bool done() const noexcept
+  {
+    return std::coroutine_handle<promise_type>::from_promise(*promise_).done();
+  }
+
+  [[nodiscard]] decltype(auto) get_result() const &
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() &&
+  {
+    return std::move(*promise_).get();
+  }
+
+  auto operator co_await() const noexcept { return awaiter{promise_.get()}; }
+  // awaits the task with `token` instead of the stop token of the awaiting coroutine
+  auto with_stop_token(std::stop_token token) const noexcept
+  {
+    return token_awaiter{{promise_.get()}, std::move(token)};
+  }
+
+private:
+  struct awaiter {
+    promise_type* p_;
+    bool await_ready() const noexcept
+    {
+      return std::coroutine_handle<promise_type>::from_promise(*p_).done();
+    }
+    // the awaited task is cancelled together with the awaiting one
+    template<typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> caller) const noexcept
+    {
+      p_->token = stop_token_of(caller);
+      p_->continuation = caller;
+      return std::coroutine_handle<promise_type>::from_promise(*p_);
+    }
+    decltype(auto) await_resume() const { return std::move(*p_).get(); }
+  };
+
+  struct token_awaiter : awaiter {
+    std::stop_token token;
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+      this->p_->token = std::move(token);
+      this->p_->continuation = caller;
+      return std::coroutine_handle<promise_type>::from_promise(*this->p_);
+    }
+  };
+
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* EVENT LOOP *********
+
+// single-threaded loop resuming coroutines when their timers expire, their file descriptors become
+// readable or they are cancelled, and running the callbacks of expired timers; `request_stop()` may
+// be called from any thread
+class event_loop {
+public:
+  using clock = std::chrono::steady_clock;
+
+  event_loop() : wake_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+  {
+    if(wake_fd_ < 0) throw std::system_error(errno, std::system_category(), "eventfd");
+  }
+  event_loop(const event_loop&) = delete;
+  event_loop& operator=(const event_loop&) = delete;
+  ~event_loop()
+  {
+    close(wake_fd_);
+  }
+
+private:
+  struct waiter;
+  using timer_map = std::multimap<clock::time_point, waiter*>;
+
+  struct waiter {
+    std::coroutine_handle<> handle;
+    void (*on_expiry)(waiter&) noexcept = nullptr;  // called instead of resuming `handle`
+    bool pending = false;  // registered with the loop, guarded by `mutex_`
+    bool queued = false;   // woken up but not resumed yet, guarded by `mutex_`
+    bool cancelled = false;
+    timer_map::iterator timer_pos;
+    int fd = -1;
+  };
+
+  // registers a waiter with the loop until it is woken up or cancelled
+  template<typename Derived>
+  class cancellable_awaiter : protected waiter {
+  public:
+    explicit cancellable_awaiter(event_loop& loop) noexcept : loop_(loop) {}
+    cancellable_awaiter(const cancellable_awaiter&) = delete;
+    cancellable_awaiter& operator=(const cancellable_awaiter&) = delete;
+    // the frame may be destroyed while suspended, e.g. a loser of `when_any()`; this has to happen on
+    // the loop thread, or while the loop is not running
+    ~cancellable_awaiter()
+    {
+      // waits for a stop callback running on another thread
+      on_stop_.reset();
+      loop_.forget(*this);
+    }
+
+    static bool await_ready() noexcept { return false; }
+    template<typename P>
+    bool await_suspend(std::coroutine_handle<P> h)
+    {
+      const auto token = stop_token_of(h);
+      if(token.stop_requested()) {
+        cancelled = true;
+        return false;
+      }
+      handle = h;
+      {
+        const std::scoped_lock lock(loop_.mutex_);
+        static_cast<Derived&>(*this).do_register();
+        pending = true;
+      }
+      // runs right away if the stop was requested in the meantime
+      on_stop_.emplace(token, stop_callback{this});
+      return true;
+    }
+    // `false` if cancelled
+    bool await_resume() noexcept
+    {
+      on_stop_.reset();
+      queued = false;
+      return !cancelled;
+    }
+
+  protected:
+    event_loop& loop_;
+
+  private:
+    struct stop_callback {
+      cancellable_awaiter* self;
+      void operator()() const noexcept { self->loop_.cancel(*self); }
+    };
+    std::optional<std::stop_callback<stop_callback>> on_stop_;
+  };
+
+public:
+  // calls `Derived::expired()` on the loop thread once the deadline passes, unless cancelled first
+  template<typename Derived>
+  class timer : waiter {
+  public:
+    explicit timer(event_loop& loop) noexcept : loop_(loop)
+    {
+      on_expiry = [](waiter& w) noexcept { static_cast<Derived&>(static_cast<timer&>(w)).expired(); };
+    }
+    timer(const timer&) = delete;
+    timer& operator=(const timer&) = delete;
+    ~timer() { cancel(); }
+
+    void arm(clock::time_point deadline)
+    {
+      const std::scoped_lock lock(loop_.mutex_);
+      timer_pos = loop_.timers_.emplace(deadline, static_cast<waiter*>(this));
+      pending = true;
+    }
+    // deregisters the timer right away, does nothing if it expired already
+    void cancel() noexcept
+    {
+      const std::scoped_lock lock(loop_.mutex_);
+      if(!pending) return;
+      loop_.timers_.erase(timer_pos);
+      pending = false;
+    }
+
+  private:
+    event_loop& loop_;
+  };
+
+  template<typename Rep, typename Period>
+  [[nodiscard]] auto sleep_for(std::chrono::duration<Rep, Period> d)
+  {
+    class awaiter : public cancellable_awaiter<awaiter> {
+    public:
+      awaiter(event_loop& loop, clock::time_point deadline) noexcept :
+          cancellable_awaiter<awaiter>(loop), deadline_(deadline)
+      {
+      }
+      void do_register() { this->timer_pos = this->loop_.timers_.emplace(deadline_, static_cast<waiter*>(this)); }
+    private:
+      clock::time_point deadline_;
+    };
+    return awaiter(*this, clock::now() + d);
+  }
+
+  // one coroutine at a time may wait for a given descriptor
+  [[nodiscard]] auto readable(int fd)
+  {
+    class awaiter : public cancellable_awaiter<awaiter> {
+    public:
+      awaiter(event_loop& loop, int fd) noexcept : cancellable_awaiter<awaiter>(loop) { this->fd = fd; }
+      void do_register() { this->loop_.readers_.emplace(this->fd, static_cast<waiter*>(this)); }
+    };
+    return awaiter(*this, fd);
+  }
+
+  [[nodiscard]] std::size_t pending_waiters() const
+  {
+    const std::scoped_lock lock(mutex_);
+    return timers_.size() + readers_.size();
+  }
+
+  // runs until nothing waits on the loop
+  void run()
+  {
+    std::vector<waiter*> expired;
+    std::vector<pollfd> fds;
+    runner_.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    while(true) {
+      int timeout = -1;
+      fds.assign(1, {wake_fd_, POLLIN, 0});
+      {
+        const std::scoped_lock lock(mutex_);
+        const auto now = clock::now();
+        while(!timers_.empty() && timers_.begin()->first <= now) wake(*timers_.begin()->second);
+        if(ready_.empty() && expired_.empty() && timers_.empty() && readers_.empty()) {
+          runner_.store({}, std::memory_order_relaxed);
+          return;
+        }
+        resuming_.swap(ready_);
+        expired.swap(expired_);
+        if(resuming_.empty() && expired.empty() && !timers_.empty())
+          timeout = static_cast<int>(
+            std::chrono::ceil<std::chrono::milliseconds>(timers_.begin()->first - now).count());
+        for(const auto& [fd, w] : readers_) fds.push_back({fd, POLLIN, 0});
+      }
+
+      // the callbacks run before any coroutine is resumed, so their timers still exist
+      // a coroutine may destroy the frame of another one in the batch, which then clears its entry
+      if(!resuming_.empty() || !expired.empty()) {
+        for(auto* w : expired) w->on_expiry(*w);
+        for(std::size_t i = 0; i < resuming_.size(); ++i)
+          if(const auto h = std::exchange(resuming_[i], nullptr)) h.resume();
+        expired.clear();
+        resuming_.clear();
+        continue;
+      }
+
+      if(poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR)
+        throw std::system_error(errno, std::system_category(), "poll");
+      if(fds[0].revents) {
+        std::uint64_t count;
+        while(read(wake_fd_, &count, sizeof(count)) > 0) {}
+        // a later `cancel()` writes again; one between the read and here only causes a spurious wake-up
+        wake_pending_.store(false, std::memory_order_release);
+      }
+      const std::scoped_lock lock(mutex_);
+      for(std::size_t i = 1; i < fds.size(); ++i)
+        if(fds[i].revents)
+          if(const auto it = readers_.find(fds[i].fd); it != readers_.end()) wake(*it->second);
+    }
+  }
+
+private:
+  // moves a registered waiter to the ready or the expired list; called with `mutex_` held
+  void wake(waiter& w)
+  {
+    if(w.fd >= 0)
+      readers_.erase(w.fd);
+    else
+      timers_.erase(w.timer_pos);
+    w.pending = false;
+    if(w.on_expiry)
+      expired_.push_back(&w);
+    else {
+      w.queued = true;
+      ready_.push_back(w.handle);
+    }
+  }
+
+  // deregisters a waiter whose frame is destroyed before it was resumed
+  void forget(waiter& w) noexcept
+  {
+    const std::scoped_lock lock(mutex_);
+    if(w.pending) {
+      if(w.fd >= 0)
+        readers_.erase(w.fd);
+      else
+        timers_.erase(w.timer_pos);
+      w.pending = false;
+    }
+    else if(w.queued) {
+      std::erase(ready_, w.handle);
+      std::replace(resuming_.begin(), resuming_.end(), w.handle, std::coroutine_handle<>());
+      w.queued = false;
+    }
+  }
+
+  void cancel(waiter& w) noexcept
+  {
+    {
+      const std::scoped_lock lock(mutex_);
+      if(!w.pending) return;
+      wake(w);
+      w.cancelled = true;
+    }
+    // the loop thread, e.g. in the callback of an expired timeout, looks at the ready list before polling
+    // again; other threads wake it up once
+    if(std::this_thread::get_id() == runner_.load(std::memory_order_relaxed)) return;
+    if(wake_pending_.exchange(true, std::memory_order_acq_rel)) return;
+    const std::uint64_t one = 1;
+    static_cast<void>(write(wake_fd_, &one, sizeof(one)));
+  }
+
+  mutable std::mutex mutex_;
+  timer_map timers_;
+  std::unordered_map<int, waiter*> readers_;
+  std::vector<std::coroutine_handle<>> ready_;
+  std::vector<std::coroutine_handle<>> resuming_;  // used by the loop thread only
+  std::vector<waiter*> expired_;
+  int wake_fd_;
+  std::atomic<bool> wake_pending_ = false;
+  std::atomic<std::thread::id> runner_;
+};
+
+
+// ********* TIMEOUT *********
+
+struct timeout_error {
+  std::chrono::nanoseconds budget;
+};
+
+template<task_value_type T>
+class [[nodiscard]] timeout_awaiter : event_loop::timer<timeout_awaiter<T>> {
+public:
+  timeout_awaiter(event_loop& loop, task<T> child, std::chrono::nanoseconds budget) :
+      event_loop::timer<timeout_awaiter>(loop), child_(std::move(child)), budget_(budget)
+  {
+  }
+
+  static bool await_ready() noexcept { return false; }
+  template<typename P>
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<P> caller)
+  {
+    if(const auto token = stop_token_of(caller); token.stop_possible())
+      forward_stop_.emplace(token, forward_stop{&source_});
+    this->arm(event_loop::clock::now() + budget_);
+    return child_.with_stop_token(source_.get_token()).await_suspend(caller);
+  }
+  // the timeout wins even if the cancelled task returns a value
+  std::expected<T, timeout_error> await_resume()
+  {
+    this->cancel();
+    forward_stop_.reset();
+    if(timed_out_) return std::unexpected(timeout_error{budget_});
+    if constexpr(std::is_void_v<T>) {
+      std::move(child_).get_result();
+      return {};
+    }
+    else
+      return std::move(child_).get_result();
+  }
+
+private:
+  friend class event_loop::timer<timeout_awaiter>;
+  void expired() noexcept
+  {
+    timed_out_ = true;
+    source_.request_stop();
+  }
+
+  struct forward_stop {
+    std::stop_source* source;
+    void operator()() const noexcept { source->request_stop(); }
+  };
+
+  task<T> child_;
+  std::chrono::nanoseconds budget_;
+  std::stop_source source_;
+  std::optional<std::stop_callback<forward_stop>> forward_stop_;
+  bool timed_out_ = false;
+};
+
+template<task_value_type T, typename Rep, typename Period>
+timeout_awaiter<T> with_timeout(event_loop& loop, task<T> child, std::chrono::duration<Rep, Period> budget)
+{
+  return {loop, std::move(child), std::chrono::duration_cast<std::chrono::nanoseconds>(budget)};
+}
+
+
+// ********* EXAMPLE *********
+
+#include <iostream>
+#include <random>
+
+using namespace std::chrono_literals;
+
+task<int> query(event_loop& loop, std::chrono::milliseconds latency, int value)
+{
+  const bool completed = co_await loop.sleep_for(latency);
+  co_return completed ? value : -1;
+}
+
+// the cancellation reaches the nested queries
+task<int> lookup(event_loop& loop, std::chrono::milliseconds latency)
+{
+  const int id = co_await query(loop, latency, 7);
+  const int row = co_await query(loop, latency, id * 6);
+  co_return row;
+}
+
+template<typename T>
+void print(const char* name, const std::expected<T, timeout_error>& result)
+{
+  std::cout << name << ": ";
+  if(result)
+    std::cout << *result;
+  else
+    std::cout << "timed out after " << std::chrono::duration<double, std::milli>(result.error().budget).count() << "ms";
+  std::cout << ", " << live_frames << " frames alive\n";
+}
+
+task<void> handler(event_loop& loop)
+{
+  const auto fast = co_await with_timeout(loop, lookup(loop, 1ms), 5ms);
+  print("fast lookup", fast);
+  const auto start = event_loop::clock::now();
+  const auto slow = co_await with_timeout(loop, lookup(loop, 10s), 5ms);
+  print("slow lookup", slow);
+  std::cout << "  resumed after "
+            << std::chrono::duration<double, std::milli>(event_loop::clock::now() - start).count() << "ms, "
+            << loop.pending_waiters() << " timers left\n";
+}
+
+// overload: a random latency between 0 and 10 ms against a 5 ms budget
+task<void> request(event_loop& loop, std::chrono::milliseconds latency, int& completed, int& timed_out)
+{
+  const auto result = co_await with_timeout(loop, lookup(loop, latency / 2), 5ms);
+  ++(result ? completed : timed_out);
+}
+
+// runs `requests` requests with the latencies drawn from `latency` against a 5 ms budget
+template<typename Latency>
+void overload(int requests, Latency latency)
+{
+  event_loop loop;
+  std::mt19937 rng(42);
+  int completed = 0;
+  int timed_out = 0;
+  std::vector<task<void>> tasks;
+  tasks.reserve(requests);
+  const auto start = event_loop::clock::now();
+  for(int i = 0; i < requests; ++i) {
+    tasks.push_back(request(loop, latency(rng), completed, timed_out));
+    tasks.back().start();
+  }
+  loop.run();
+  const auto elapsed = event_loop::clock::now() - start;
+  std::cout << requests << " requests: " << completed << " completed, " << timed_out << " timed out in "
+            << std::chrono::duration<double, std::milli>(elapsed).count() << "ms, "
+            << live_frames - static_cast<std::size_t>(requests) << " child frames and " << loop.pending_waiters()
+            << " timers left\n";
+}
+
+int main()
+{
+  {
+    event_loop loop;
+    const auto t = handler(loop);
+    t.start();
+    loop.run();
+  }
+
+  std::uniform_int_distribution<int> latency(0, 10);
+  overload(1'000, [&](std::mt19937& rng) { return std::chrono::milliseconds(latency(rng)); });
+
+  // more timeouts expiring at once than a pipe could buffer wake-ups for; they cancel from the loop thread
+  overload(100'000, [](std::mt19937&) { return std::chrono::milliseconds(10s); });
+}
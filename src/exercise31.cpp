@@ -0,0 +1,737 @@
+// - Run `task<T>` coroutines thread-per-core: every shard owns a thread, a ready queue and a timer
+//   heap, and shares nothing with the other shards
+//   - the threads are pinned to the CPUs of the process with `sched_setaffinity`
+//   - frames are allocated from a pool owned by the shard, whose blocks are first written by its
+//     pinned thread, so Linux's first-touch policy places them on the local NUMA node
+//   - `co_await resume_on(ex, shard)` is the only way to move a coroutine to another shard, through
+//     a single-producer single-consumer mailbox per pair of shards
+//   - `co_await yield(ex)` and `co_await sleep_for(ex, d)` stay on the current shard
+//   - idle shards sleep on a futex until a mailbox receives a coroutine or their next timer expires
+// - Compare the latency percentiles with a pool of threads sharing one queue
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* FRAME POOL *********
+
+// pool of the shard running on the current thread; frames allocated elsewhere use global new
+class frame_pool {
+public:
+  static constexpr std::size_t min_size_log2 = 6;  // 64 bytes
+  static constexpr std::size_t max_size_log2 = 12; // 4 KiB
+  static constexpr std::size_t size_classes = max_size_log2 - min_size_log2 + 1;
+  static constexpr std::size_t chunk_size = 64 * 1024;
+
+  frame_pool() = default;
+  frame_pool(const frame_pool&) = delete;
+  frame_pool& operator=(const frame_pool&) = delete;
+
+  inline static thread_local frame_pool* current = nullptr;
+
+  [[nodiscard]] static void* allocate(std::size_t size)
+  {
+    const auto cls = size_class(size);
+    if(cls == size_classes || !current) {
+      auto* h = new(::operator new(sizeof(header) + size)) header{nullptr, cls};
+      return h + 1;
+    }
+    return current->allocate_from(cls);
+  }
+
+  static void deallocate(void* ptr) noexcept
+  {
+    auto* h = static_cast<header*>(ptr) - 1;
+    if(!h->owner)
+      ::operator delete(h);
+    else if(h->owner == current)
+      current->push_local(h);
+    else
+      h->owner->push_remote(h);
+  }
+
+private:
+  // placed in front of every frame; keeps the frame aligned to the default new alignment
+  struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) header {
+    frame_pool* owner;
+    std::size_t cls;
+  };
+  struct free_block {
+    free_block* next;
+  };
+
+  std::array<free_block*, size_classes> local_{};
+  std::array<std::atomic<free_block*>, size_classes> remote_{};
+  std::vector<std::unique_ptr<std::byte[]>> chunks_;
+
+  static constexpr std::size_t size_class(std::size_t size) noexcept
+  {
+    const auto total = size + sizeof(header);
+    if(total > (std::size_t{1} << max_size_log2)) return size_classes;
+    const auto log2 = static_cast<std::size_t>(std::bit_width(total - 1));
+    return log2 < min_size_log2 ? 0 : log2 - min_size_log2;
+  }
+
+  void* allocate_from(std::size_t cls)
+  {
+    free_block* b = local_[cls];
+    if(!b) b = remote_[cls].exchange(nullptr, std::memory_order_acquire);
+    if(!b) b = refill(cls);
+    local_[cls] = b->next;
+    auto* h = new(b) header{this, cls};
+    return h + 1;
+  }
+
+  // carves a new chunk into blocks; linking them touches every page from the pinned thread
+  free_block* refill(std::size_t cls)
+  {
+    const auto block = std::size_t{1} << (cls + min_size_log2);
+    auto& chunk = chunks_.emplace_back(new std::byte[chunk_size]);
+    free_block* head = nullptr;
+    for(std::size_t offset = chunk_size; offset >= block; offset -= block)
+      head = new(chunk.get() + offset - block) free_block{head};
+    return head;
+  }
+
+  void push_local(header* h) noexcept
+  {
+    const auto cls = h->cls;
+    local_[cls] = new(h) free_block{local_[cls]};
+  }
+
+  void push_remote(header* h) noexcept
+  {
+    auto& head = remote_[h->cls];
+    auto* b = new(h) free_block{head.load(std::memory_order_relaxed)};
+    while(!head.compare_exchange_weak(b->next, b, std::memory_order_release, std::memory_order_relaxed)) {}
+  }
+};
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return *result;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+
+  static void* operator new(std::size_t size) { return frame_pool::allocate(size); }
+  static void operator delete(void* ptr, std::size_t) noexcept { frame_pool::deallocate(ptr); }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+  };
+
+  [[nodiscard]] decltype(auto) get_result() const &
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() const &&
+  {
+    return std::move(promise_)->get();
+  }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      bool await_ready() const noexcept
+      {
+        return std::coroutine_handle<promise_type>::from_promise(*p_).done();
+      }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        p_->continuation = caller;
+        return std::coroutine_handle<promise_type>::from_promise(*p_);
+      }
+      decltype(auto) await_resume() const { return std::move(*p_).get(); }
+    };
+    return awaiter{promise_.get()};
+  }
+
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* MAILBOX *********
+
+// bounded single-producer single-consumer ring of coroutine handles
+class mailbox {
+public:
+  static constexpr std::size_t capacity = 256;
+
+  // producer side; `false` if the mailbox is full
+  bool push(std::coroutine_handle<> h) noexcept
+  {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    if(tail - head_cache_ == capacity) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if(tail - head_cache_ == capacity) return false;
+    }
+    slots_[tail % capacity] = h;
+    // sequentially consistent, so either the consumer sees the handle before going to sleep or the
+    // producer sees it sleeping
+    tail_.store(tail + 1, std::memory_order_seq_cst);
+    return true;
+  }
+
+  // consumer side
+  std::coroutine_handle<> pop() noexcept
+  {
+    const auto head = head_.load(std::memory_order_relaxed);
+    if(head == tail_cache_) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if(head == tail_cache_) return {};
+    }
+    const auto h = slots_[head % capacity];
+    head_.store(head + 1, std::memory_order_release);
+    return h;
+  }
+  [[nodiscard]] bool empty() const noexcept
+  {
+    return tail_.load(std::memory_order_seq_cst) == head_.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::array<std::coroutine_handle<>, capacity> slots_{};
+  // consumer side
+  alignas(64) std::atomic<std::size_t> head_ = 0;
+  std::size_t tail_cache_ = 0;
+  // producer side
+  alignas(64) std::atomic<std::size_t> tail_ = 0;
+  std::size_t head_cache_ = 0;
+};
+
+
+// ********* SHARDED EXECUTOR *********
+
+namespace detail {
+
+inline void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected, const timespec* timeout) noexcept
+{
+  static_assert(sizeof(word) == sizeof(std::uint32_t) && std::atomic<std::uint32_t>::is_always_lock_free);
+  syscall(SYS_futex, &word, FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0);
+}
+
+inline void futex_wake(std::atomic<std::uint32_t>& word) noexcept
+{
+  syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+} // namespace detail
+
+class sharded_executor {
+public:
+  using clock = std::chrono::steady_clock;
+  static constexpr std::size_t no_shard = static_cast<std::size_t>(-1);
+
+  // shard `i` is pinned to the `i`-th CPU the process may run on, wrapping around
+  explicit sharded_executor(std::size_t shards)
+  {
+    if(shards == 0) throw std::invalid_argument("sharded_executor needs at least one shard");
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+      throw std::system_error(errno, std::system_category(), "sched_getaffinity");
+    std::vector<int> cpus;
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      if(CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+
+    for(std::size_t i = 0; i < shards; ++i)
+      shards_.push_back(std::make_unique<shard>(*this, i, cpus[i % cpus.size()], shards));
+    for(auto& s : shards_) s->thread = std::thread([this, &s = *s] { run(s); });
+  }
+  sharded_executor(const sharded_executor&) = delete;
+  sharded_executor& operator=(const sharded_executor&) = delete;
+
+  // every coroutine must have finished, their frames may live in the pools of the shards
+  ~sharded_executor()
+  {
+    stopping_.store(true, std::memory_order_seq_cst);
+    for(auto& s : shards_) {
+      s->futex_word.fetch_add(1, std::memory_order_release);
+      detail::futex_wake(s->futex_word);
+    }
+    for(auto& s : shards_) s->thread.join();
+  }
+
+  [[nodiscard]] std::size_t size() const noexcept { return shards_.size(); }
+  [[nodiscard]] int cpu_of(std::size_t shard) const noexcept { return shards_[shard]->cpu; }
+  // the shard running the current thread, `no_shard` outside of the executor
+  [[nodiscard]] std::size_t current_shard() const noexcept
+  {
+    return current_ && &current_->executor == this ? current_->index : no_shard;
+  }
+
+  // moves the current coroutine to `shard`
+  [[nodiscard]] auto resume_on(std::size_t shard) noexcept
+  {
+    struct awaiter {
+      sharded_executor& ex;
+      std::size_t target;
+      bool await_ready() const noexcept { return ex.current_shard() == target; }
+      void await_suspend(std::coroutine_handle<> h) const { ex.send(target, h); }
+      static void await_resume() noexcept {}
+    };
+    return awaiter{*this, shard};
+  }
+
+  // lets the other coroutines ready on the current shard run first
+  [[nodiscard]] auto yield() noexcept
+  {
+    struct awaiter {
+      sharded_executor& ex;
+      static bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) const { ex.local().ready.push_back(h); }
+      static void await_resume() noexcept {}
+    };
+    return awaiter{*this};
+  }
+
+  // must be awaited on a shard, the coroutine is resumed on the same shard
+  template<typename Rep, typename Period>
+  [[nodiscard]] auto sleep_for(std::chrono::duration<Rep, Period> d) noexcept
+  {
+    struct awaiter {
+      sharded_executor& ex;
+      clock::time_point deadline;
+      static bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) const { ex.local().timers.push({deadline, h}); }
+      static void await_resume() noexcept {}
+    };
+    return awaiter{*this, clock::now() + d};
+  }
+
+private:
+  struct timer {
+    clock::time_point deadline;
+    std::coroutine_handle<> handle;
+    friend bool operator>(const timer& a, const timer& b) noexcept { return a.deadline > b.deadline; }
+  };
+
+  struct shard {
+    shard(sharded_executor& ex, std::size_t i, int c, std::size_t shards) :
+        executor(ex), index(i), cpu(c), inbox(new mailbox[shards]), overflow(shards)
+    {
+    }
+
+    sharded_executor& executor;
+    const std::size_t index;
+    const int cpu;
+    frame_pool frames;
+    // only accessed by the thread of the shard
+    std::deque<std::coroutine_handle<>> ready;
+    std::priority_queue<timer, std::vector<timer>, std::greater<>> timers;
+    // `inbox[from]` is written by shard `from` only
+    std::unique_ptr<mailbox[]> inbox;
+    // `overflow[to]` keeps the coroutines sent to shard `to` while its inbox was full
+    std::vector<std::deque<std::coroutine_handle<>>> overflow;
+    // coroutines posted from outside the executor
+    std::mutex external_mutex;
+    std::vector<std::coroutine_handle<>> external;
+    alignas(64) std::atomic<std::uint32_t> futex_word = 0;
+    std::atomic<bool> sleeping = false;
+    std::thread thread;
+  };
+
+  inline static thread_local shard* current_ = nullptr;
+
+  shard& local() const noexcept { return *current_; }
+
+  void send(std::size_t target, std::coroutine_handle<> h)
+  {
+    auto& to = *shards_[target];
+    if(const auto from = current_shard(); from != no_shard) {
+      auto& overflow = current_->overflow[target];
+      if(!overflow.empty() || !to.inbox[from].push(h)) {
+        overflow.push_back(h);
+        return;
+      }
+    }
+    else {
+      const std::scoped_lock lock(to.external_mutex);
+      to.external.push_back(h);
+    }
+    notify(to);
+  }
+
+  static void notify(shard& s) noexcept
+  {
+    if(s.sleeping.load(std::memory_order_seq_cst)) {
+      s.futex_word.fetch_add(1, std::memory_order_release);
+      detail::futex_wake(s.futex_word);
+    }
+  }
+
+  // moves everything that became ready to the ready queue
+  void collect(shard& s)
+  {
+    for(std::size_t from = 0; from < shards_.size(); ++from)
+      while(const auto h = s.inbox[from].pop()) s.ready.push_back(h);
+    {
+      const std::scoped_lock lock(s.external_mutex);
+      s.ready.insert(s.ready.end(), s.external.begin(), s.external.end());
+      s.external.clear();
+    }
+    for(const auto now = clock::now(); !s.timers.empty() && s.timers.top().deadline <= now; s.timers.pop())
+      s.ready.push_back(s.timers.top().handle);
+    for(std::size_t to = 0; to < shards_.size(); ++to) {
+      auto& overflow = s.overflow[to];
+      bool sent = false;
+      while(!overflow.empty() && shards_[to]->inbox[s.index].push(overflow.front())) {
+        overflow.pop_front();
+        sent = true;
+      }
+      if(sent) notify(*shards_[to]);
+    }
+  }
+
+  [[nodiscard]] bool has_incoming(shard& s)
+  {
+    for(std::size_t from = 0; from < shards_.size(); ++from)
+      if(!s.inbox[from].empty()) return true;
+    const std::scoped_lock lock(s.external_mutex);
+    return !s.external.empty();
+  }
+
+  void run(shard& s)
+  {
+    // best effort, the affinity may be restricted, e.g. in containers
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(s.cpu, &set);
+    static_cast<void>(sched_setaffinity(0, sizeof(set), &set));
+    current_ = &s;
+    frame_pool::current = &s.frames;
+
+    while(true) {
+      collect(s);
+      if(!s.ready.empty()) {
+        // the coroutines made ready meanwhile wait for the next round
+        for(auto n = s.ready.size(); n > 0; --n) {
+          const auto h = s.ready.front();
+          s.ready.pop_front();
+          h.resume();
+        }
+        continue;
+      }
+      if(stopping_.load(std::memory_order_acquire)) break;
+
+      const auto seen = s.futex_word.load(std::memory_order_acquire);
+      s.sleeping.store(true, std::memory_order_seq_cst);
+      if(!has_incoming(s) && !stopping_.load(std::memory_order_seq_cst)) {
+        // wake up for the next timer, or soon if some inbox of another shard was full
+        std::optional<std::chrono::nanoseconds> timeout;
+        if(!s.timers.empty()) timeout = std::max(s.timers.top().deadline - clock::now(), clock::duration::zero());
+        if(std::ranges::any_of(s.overflow, [](const auto& o) { return !o.empty(); }))
+          timeout = std::min(timeout.value_or(std::chrono::nanoseconds::max()), std::chrono::nanoseconds(50'000));
+        if(timeout) {
+          const auto sec = std::chrono::duration_cast<std::chrono::seconds>(*timeout);
+          const timespec ts{static_cast<time_t>(sec.count()), static_cast<long>((*timeout - sec).count())};
+          detail::futex_wait(s.futex_word, seen, &ts);
+        }
+        else
+          detail::futex_wait(s.futex_word, seen, nullptr);
+      }
+      s.sleeping.store(false, std::memory_order_relaxed);
+    }
+
+    frame_pool::current = nullptr;
+    current_ = nullptr;
+  }
+
+  std::vector<std::unique_ptr<shard>> shards_;
+  std::atomic<bool> stopping_ = false;
+};
+
+[[nodiscard]] inline auto resume_on(sharded_executor& ex, std::size_t shard) noexcept { return ex.resume_on(shard); }
+
+
+// ********* EXAMPLE *********
+
+#include <condition_variable>
+#include <iostream>
+#include <latch>
+
+// what we compare against: threads sharing a single queue
+class shared_pool {
+public:
+  explicit shared_pool(std::size_t threads)
+  {
+    for(std::size_t i = 0; i < threads; ++i) threads_.emplace_back([this] { run(); });
+  }
+  ~shared_pool()
+  {
+    {
+      const std::scoped_lock lock(mutex_);
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    for(auto& t : threads_) t.join();
+  }
+
+  [[nodiscard]] auto schedule() noexcept
+  {
+    struct awaiter {
+      shared_pool& pool;
+      static bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) const
+      {
+        // the awaiter may be gone as soon as another thread resumes the coroutine
+        auto& p = pool;
+        {
+          const std::scoped_lock lock(p.mutex_);
+          p.queue_.push_back(h);
+        }
+        p.cv_.notify_one();
+      }
+      static void await_resume() noexcept {}
+    };
+    return awaiter{*this};
+  }
+
+private:
+  void run()
+  {
+    while(true) {
+      std::unique_lock lock(mutex_);
+      cv_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+      if(queue_.empty()) return;
+      const auto h = queue_.front();
+      queue_.pop_front();
+      lock.unlock();
+      h.resume();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::coroutine_handle<>> queue_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+// fire-and-forget coroutine used to start a task and signal its completion
+struct detached {
+  struct promise_type {
+    static std::suspend_never initial_suspend() noexcept { return {}; }
+    static std::suspend_never final_suspend() noexcept { return {}; }
+    static detached get_return_object() noexcept { return {}; }
+    static void return_void() noexcept {}
+    [[noreturn]] static void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+template<typename T>
+detached spawn(task<T> t, std::latch& done)
+{
+  co_await t;
+  done.count_down();
+}
+
+auto start_on(sharded_executor& ex, std::size_t i) { return ex.resume_on(i % ex.size()); }
+auto start_on(shared_pool& pool, std::size_t) { return pool.schedule(); }
+auto yield(sharded_executor& ex) { return ex.yield(); }
+auto yield(shared_pool& pool) { return pool.schedule(); }
+
+task<void> where(sharded_executor& ex)
+{
+  std::cout << "started outside of the executor: shard " << static_cast<long>(ex.current_shard()) << "\n";
+  co_await resume_on(ex, 0);
+  std::cout << "resumed on shard " << ex.current_shard() << " (cpu " << ex.cpu_of(0) << ")\n";
+  co_await resume_on(ex, ex.size() - 1);
+  std::cout << "resumed on shard " << ex.current_shard() << " (cpu " << ex.cpu_of(ex.size() - 1) << ")\n";
+  co_await ex.sleep_for(std::chrono::milliseconds(1));
+  std::cout << "after sleeping, still on shard " << ex.current_shard() << "\n";
+}
+
+// a request made of a few steps, letting other requests run in between
+template<typename Executor>
+task<unsigned> handle_request(Executor& ex, unsigned seed)
+{
+  for(int step = 0; step < 4; ++step) {
+    for(int i = 0; i < 200; ++i) seed = seed * 1664525 + 1013904223;
+    co_await yield(ex);
+  }
+  co_return seed;
+}
+
+template<typename Executor>
+task<void> client(Executor& ex, std::size_t id, int requests, std::vector<std::chrono::nanoseconds>& latencies)
+{
+  co_await start_on(ex, id);
+  unsigned seed = static_cast<unsigned>(id);
+  for(int i = 0; i < requests; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    seed = co_await handle_request(ex, seed);
+    latencies.push_back(std::chrono::steady_clock::now() - start);
+  }
+}
+
+template<typename Executor>
+void bench(const char* name, Executor& ex, std::size_t clients, int requests)
+{
+  std::vector<std::vector<std::chrono::nanoseconds>> latencies(clients);
+  for(auto& l : latencies) l.reserve(requests);
+  std::latch done(static_cast<std::ptrdiff_t>(clients));
+  const auto start = std::chrono::steady_clock::now();
+  for(std::size_t c = 0; c < clients; ++c) spawn(client(ex, c, requests, latencies[c]), done);
+  done.wait();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  std::vector<std::chrono::nanoseconds> all;
+  for(const auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+  const auto percentile = [&](double p) {
+    const auto nth = all.begin() + static_cast<std::ptrdiff_t>(p * static_cast<double>(all.size() - 1));
+    std::ranges::nth_element(all, nth);
+    return std::chrono::duration<double, std::micro>(*nth).count();
+  };
+  std::cout << name << ": " << static_cast<double>(all.size()) / std::chrono::duration<double>(elapsed).count()
+            << " requests/s, p50 " << percentile(0.5) << "us, p99 " << percentile(0.99) << "us, p99.9 "
+            << percentile(0.999) << "us\n";
+}
+
+int main()
+{
+  const std::size_t shards = std::max(2u, std::thread::hardware_concurrency());
+  {
+    sharded_executor ex(shards);
+    std::latch done(1);
+    spawn(where(ex), done);
+    done.wait();
+  }
+
+  constexpr int requests = 20'000;
+  const std::size_t clients = 4 * shards;
+  {
+    sharded_executor ex(shards);
+    bench("sharded executor", ex, clients, requests);
+  }
+  {
+    shared_pool pool(shards);
+    bench("shared queue    ", pool, clients, requests);
+  }
+}
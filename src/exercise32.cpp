@@ -0,0 +1,361 @@
+// - Block a non-coroutine caller until a lazy `task<T>` completes with `sync_wait(t)`
+//   - the calling thread parks on a 32-bit atomic in a `sync_frame` on its own stack, using a futex
+//   - the final suspend point of the task wakes it instead of resuming a continuation
+//   - the result is returned, the exception rethrown
+//   - nothing is allocated besides the frame of the task: no shared state, mutex or condition
+//     variable as with `std::future`
+//   - if the task completes on the calling thread, no system call is made at all
+// - Compare with blocking on a `std::future`
+
+#include <atomic>
+#include <concepts>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <utility>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+// ********* SYNC FRAME *********
+
+namespace detail {
+
+// one-shot event a thread can block on
+class sync_frame {
+public:
+  sync_frame() noexcept = default;
+  sync_frame(const sync_frame&) = delete;
+  sync_frame& operator=(const sync_frame&) = delete;
+
+  void wait() noexcept
+  {
+    for(int i = 0; i < spins; ++i)
+      if(state_.load(std::memory_order_acquire) == done) return;
+    auto state = pending;
+    if(!state_.compare_exchange_strong(state, sleeping, std::memory_order_acquire)) return;
+    do
+      syscall(SYS_futex, &state_, FUTEX_WAIT_PRIVATE, sleeping, nullptr, nullptr, 0);
+    while(state_.load(std::memory_order_acquire) != done);
+  }
+
+  // the waiting thread may return, and the frame go away, as soon as the state is `done`: only its
+  // address is passed to the kernel afterwards
+  void notify() noexcept
+  {
+    if(state_.exchange(done, std::memory_order_acq_rel) == sleeping)
+      syscall(SYS_futex, &state_, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+  }
+
+private:
+  static constexpr int spins = 64;
+  static constexpr std::uint32_t pending = 0;
+  static constexpr std::uint32_t sleeping = 1;
+  static constexpr std::uint32_t done = 2;
+  static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+  std::atomic<std::uint32_t> state_ = pending;
+};
+
+} // namespace detail
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] const T& get() const &
+  {
+    rethrow_if_exception();
+    return *result;
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    detail::sync_frame* sync = nullptr;
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          auto& promise = h.promise();
+          if(!promise.sync) return promise.continuation;
+          // the waiting thread may destroy the frame from here on
+          promise.sync->notify();
+          return std::noop_coroutine();
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept { return this; }
+  };
+
+  [[nodiscard]] decltype(auto) get_result() const &
+  {
+    return promise_->get();
+  }
+  [[nodiscard]] decltype(auto) get_result() const &&
+  {
+    return std::move(promise_)->get();
+  }
+
+  auto operator co_await() const noexcept
+  {
+    struct awaiter {
+      promise_type* p_;
+      bool await_ready() const noexcept
+      {
+        return std::coroutine_handle<promise_type>::from_promise(*p_).done();
+      }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        p_->continuation = caller;
+        return std::coroutine_handle<promise_type>::from_promise(*p_);
+      }
+      decltype(auto) await_resume() const { return std::move(*p_).get(); }
+    };
+    return awaiter{promise_.get()};
+  }
+
+  // starts the task and blocks the calling thread until it completes
+  friend T sync_wait(const task& t)
+  {
+    detail::sync_frame frame;
+    t.promise_->sync = &frame;
+    std::coroutine_handle<promise_type>::from_promise(*t.promise_).resume();
+    frame.wait();
+    return std::move(*t.promise_).get();
+  }
+
+private:
+  task(promise_type* p) : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+
+// ********* EXAMPLE *********
+
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+// count calls to the global allocator, from any thread
+inline std::atomic<std::size_t> global_allocations = 0;
+
+void* operator new(std::size_t size)
+{
+  global_allocations.fetch_add(1, std::memory_order_relaxed);
+  if(void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+// resumes one coroutine at a time on its own thread, without allocating
+class worker {
+public:
+  worker() : thread_([this](std::stop_token token) { run(token); }) {}
+  ~worker()
+  {
+    thread_.request_stop();
+    slot_.store(&stop_marker, std::memory_order_release);
+    slot_.notify_one();
+  }
+
+  [[nodiscard]] auto schedule() noexcept
+  {
+    struct awaiter {
+      worker& w;
+      static bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) const noexcept
+      {
+        auto& slot = w.slot_;
+        slot.store(h.address(), std::memory_order_release);
+        slot.notify_one();
+      }
+      static void await_resume() noexcept {}
+    };
+    return awaiter{*this};
+  }
+
+private:
+  void run(std::stop_token token)
+  {
+    while(!token.stop_requested()) {
+      slot_.wait(nullptr, std::memory_order_acquire);
+      void* address = slot_.exchange(nullptr, std::memory_order_acquire);
+      if(address && address != &stop_marker) std::coroutine_handle<>::from_address(address).resume();
+    }
+  }
+
+  inline static int stop_marker = 0;
+  std::atomic<void*> slot_ = nullptr;
+  std::jthread thread_;
+};
+
+task<int> answer()
+{
+  co_return 42;
+}
+
+task<int> answer_on(worker& w)
+{
+  co_await w.schedule();
+  co_return 42;
+}
+
+task<void> failing()
+{
+  throw std::runtime_error("backend unavailable");
+  co_return;
+}
+
+// fire-and-forget coroutine fulfilling a `std::promise`
+struct detached {
+  struct promise_type {
+    static std::suspend_never initial_suspend() noexcept { return {}; }
+    static std::suspend_never final_suspend() noexcept { return {}; }
+    static detached get_return_object() noexcept { return {}; }
+    static void return_void() noexcept {}
+    [[noreturn]] static void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+detached fulfil_on(worker& w, std::promise<int>& p)
+{
+  co_await w.schedule();
+  p.set_value(42);
+}
+
+template<typename F>
+void bench(const char* name, int iterations, F op)
+{
+  long sum = 0;
+  const auto allocations = global_allocations.load();
+  const auto start = std::chrono::steady_clock::now();
+  for(int i = 0; i < iterations; ++i) sum += op();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << name << ": " << std::chrono::duration<double, std::nano>(elapsed).count() / iterations << " ns, "
+            << static_cast<double>(global_allocations - allocations) / iterations << " allocations per call"
+            << (sum == 42L * iterations ? "" : " (wrong result)") << "\n";
+}
+
+int main()
+{
+  std::cout << "sync_wait(answer()) = " << sync_wait(answer()) << "\n";
+  try {
+    sync_wait(failing());
+  }
+  catch(const std::exception& ex) {
+    std::cout << "sync_wait(failing()) threw: " << ex.what() << "\n";
+  }
+
+  worker w;
+  constexpr int inline_iterations = 1'000'000;
+  constexpr int thread_iterations = 50'000;
+  bench("sync_wait, completed inline          ", inline_iterations, [] { return sync_wait(answer()); });
+  bench("std::future, completed inline        ", inline_iterations, [] {
+    std::promise<int> p;
+    auto f = p.get_future();
+    p.set_value(sync_wait(answer()));
+    return f.get();
+  });
+  bench("sync_wait, completed on a worker     ", thread_iterations, [&] { return sync_wait(answer_on(w)); });
+  bench("std::future, completed on a worker   ", thread_iterations, [&] {
+    std::promise<int> p;
+    auto f = p.get_future();
+    fulfil_on(w, p);
+    return f.get();
+  });
+}
@@ -0,0 +1,718 @@
+// - Fuse the stages of a stream pipeline at compile time: `source | map(f) | filter(p) | batch(n) | sink`
+//   - chaining `generator<T>` stages costs a coroutine frame per stage and a resume per stage and element
+//   - values are pushed through the stages: each stage wraps the consumer downstream of it, and applying the
+//     sink builds the chain back to front, so `map`, `filter` and `take` are inlined into the loop over the source
+//   - `batch(n)` buffers elements and passes a `std::span` of them on; it has state, but needs no suspension
+//   - the source is any input range: a container, a `std::views` pipeline, a `generator<T>`
+// - Sinks: `for_each(f)`, `fold(init, f)` and `to_vector()` run the pipeline synchronously
+//   - `co_for_each(f)`, with `f` returning a `task<void>`, is the only coroutine boundary: the whole pipeline runs
+//     in one task, which awaits `f` for each value leaving the stages (for each batch after `batch(n)`)
+// - Compare a 5-stage pipeline with a hand-written loop and with chained generators, in ns per element
+
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+inline std::size_t frame_allocations = 0;
+
+
+// ********* RAII *********
+
+struct coro_deleter {
+  template<typename Promise>
+  void operator()(Promise* promise) const noexcept
+  {
+    auto handle = std::coroutine_handle<Promise>::from_promise(*promise);
+    if(handle)
+      handle.destroy();
+  }
+};
+template<typename T>
+using promise_ptr = std::unique_ptr<T, coro_deleter>;
+
+
+
+// ********* GENERATOR *********
+
+template<typename T>
+class [[nodiscard]] generator : public std::ranges::view_interface<generator<T>> {
+public:
+  using value_type = std::remove_cvref_t<T>;
+  using reference = std::conditional_t<std::is_reference_v<T>, T, const T&>;
+
+  struct promise_type {
+    std::add_pointer_t<reference> value = nullptr;
+
+    generator get_return_object() noexcept { return this; }
+    auto await_transform(auto) = delete;
+    void unhandled_exception() { throw; }
+    void return_void() noexcept {}
+
+    std::suspend_always initial_suspend() noexcept { return {}; };
+    std::suspend_always final_suspend() noexcept { return {}; }
+
+    // the yielded object outlives the suspension, so its address is all we need
+    std::suspend_always yield_value(reference expr) noexcept {
+      value = std::addressof(expr);
+      return {};
+    }
+
+    static void* operator new(std::size_t size)
+    {
+      ++frame_allocations;
+      return ::operator new(size);
+    }
+    static void operator delete(void* ptr, std::size_t size) noexcept { ::operator delete(ptr, size); }
+  };
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  class iterator {
+  public:
+    using value_type = generator::value_type;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+    iterator(iterator&&) = default;
+    iterator& operator=(iterator&&) = default;
+
+    reference operator*() const noexcept { return static_cast<reference>(*handle_.promise().value); }
+
+    iterator& operator++()
+    {
+      handle_.resume();
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    friend bool operator==(const iterator& it, std::default_sentinel_t) noexcept { return it.handle_.done(); }
+
+  private:
+    friend generator;
+    explicit iterator(handle_type h) noexcept : handle_(h) {}
+    handle_type handle_;
+  };
+
+  generator(generator&&) noexcept = default;
+  generator& operator=(generator&&) noexcept = default;
+
+  // resumes the coroutine up to its first `co_yield`; may be called only once
+  iterator begin()
+  {
+    auto handle = handle_type::from_promise(*promise_);
+    handle.resume();
+    return iterator(handle);
+  }
+  static std::default_sentinel_t end() noexcept { return {}; }
+
+  bool next() {
+    auto handle = handle_type::from_promise(*promise_);
+    handle.resume();
+    return !handle.done();
+  }
+
+  reference value() const noexcept {
+    return static_cast<reference>(*promise_->value);
+  }
+
+private:
+  generator(promise_type* p) noexcept : promise_(p) {}
+  promise_ptr<promise_type> promise_;
+};
+
+static_assert(std::ranges::input_range<generator<int>>);
+static_assert(std::ranges::view<generator<int>>);
+
+
+// ********* STORAGE **********
+
+namespace detail {
+
+class storage_base {
+protected:
+  std::exception_ptr exception;
+  void rethrow_if_exception() const
+  {
+    if(exception) std::rethrow_exception(exception);
+  }
+public:
+  void set_exception(std::exception_ptr ptr) noexcept { exception = std::move(ptr); }
+};
+
+template<typename T>
+class storage : public storage_base {
+protected:
+  std::optional<T> result;
+public:
+  using value_type = T;
+
+  template<std::convertible_to<T> U>
+  void set_value(U&& value) noexcept(std::is_nothrow_constructible_v<T, decltype(std::forward<U>(value))>)
+  {
+    result = std::forward<U>(value);
+  }
+  [[nodiscard]] T&& get() &&
+  {
+    rethrow_if_exception();
+    return *std::move(result);
+  }
+};
+
+template<>
+class storage<void> : public storage_base {
+public:
+  void get() const { rethrow_if_exception(); }
+};
+
+}
+
+// ********* TASK *********
+
+namespace detail {
+
+template<typename T>
+struct task_promise_storage_base : storage<T> {
+  void unhandled_exception() noexcept { this->set_exception(std::current_exception()); }
+
+  // counts the frames of the tasks
+  static void* operator new(std::size_t size)
+  {
+    ++frame_allocations;
+    return ::operator new(size);
+  }
+  static void operator delete(void* ptr, std::size_t size) noexcept { ::operator delete(ptr, size); }
+};
+
+template<typename T>
+struct task_promise_storage : task_promise_storage_base<T> {
+  template<std::convertible_to<T> U>
+  void return_value(U&& value) noexcept(noexcept(this->set_value(std::forward<U>(value))))
+    requires requires { this->set_value(std::forward<U>(value)); }
+  {
+    this->set_value(std::forward<U>(value));
+  }
+};
+
+template<>
+struct task_promise_storage<void> : task_promise_storage_base<void> {
+  void return_void() noexcept {}
+};
+
+} // namespace detail
+
+template<typename T>
+concept task_value_type = std::move_constructible<T> || std::is_void_v<T>;
+
+template<task_value_type T>
+struct [[nodiscard]] task {
+  struct promise_type : detail::task_promise_storage<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    static std::suspend_always initial_suspend() noexcept { return {}; }
+    static auto final_suspend() noexcept
+    {
+      struct final_awaiter {
+        static bool await_ready() noexcept { return false; }
+        static std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+        {
+          return h.promise().continuation;
+        }
+        static void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+    task get_return_object() noexcept
+    {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+  };
+
+  task(task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+  task& operator=(task&&) = delete;
+  ~task()
+  {
+    if(handle_) handle_.destroy();
+  }
+
+  // starts the task from a non-coroutine context; returns once it suspends for the first time
+  void start() const { handle_.resume(); }
+  [[nodiscard]] decltype(auto) get_result() && { return std::move(handle_.promise()).get(); }
+
+  auto operator co_await() && noexcept
+  {
+    struct awaiter {
+      std::coroutine_handle<promise_type> h;
+      static bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) const noexcept
+      {
+        h.promise().continuation = caller;
+        return h;
+      }
+      decltype(auto) await_resume() const { return std::move(h.promise()).get(); }
+    };
+    return awaiter{handle_};
+  }
+
+private:
+  explicit task(std::coroutine_handle<promise_type> h) noexcept : handle_(h) {}
+  std::coroutine_handle<promise_type> handle_;
+};
+
+
+// ********* PIPELINE *********
+
+// A stage is turned into a consumer by `bind<In>(next)`, given the type `In` of the values it receives and the
+// consumer `next` it passes its `output<In>` values to. A consumer has
+//   - `bool push(In)`, which returns false once no more values are wanted
+//   - `void finish()`, called after the last value
+namespace pipeline {
+
+struct stage_tag {};
+struct sink_tag {};
+
+template<typename S>
+concept stage = std::derived_from<std::remove_cvref_t<S>, stage_tag>;
+template<typename S>
+concept sink = std::derived_from<std::remove_cvref_t<S>, sink_tag>;
+
+template<typename F>
+struct map_stage : stage_tag {
+  F f;
+
+  template<typename In>
+  using output = std::invoke_result_t<F&, In>;
+
+  template<typename In, typename Next>
+  auto bind(Next next) &&
+  {
+    struct consumer {
+      F f;
+      Next next;
+      bool push(In value) { return next.push(std::invoke(f, std::forward<In>(value))); }
+      void finish() { next.finish(); }
+    };
+    return consumer{std::move(f), std::move(next)};
+  }
+};
+
+template<typename P>
+struct filter_stage : stage_tag {
+  P pred;
+
+  template<typename In>
+  using output = In;
+
+  template<typename In, typename Next>
+  auto bind(Next next) &&
+  {
+    struct consumer {
+      P pred;
+      Next next;
+      bool push(In value) { return !std::invoke(pred, std::as_const(value)) || next.push(std::forward<In>(value)); }
+      void finish() { next.finish(); }
+    };
+    return consumer{std::move(pred), std::move(next)};
+  }
+};
+
+struct take_stage : stage_tag {
+  std::size_t count;
+
+  template<typename In>
+  using output = In;
+
+  template<typename In, typename Next>
+  auto bind(Next next) &&
+  {
+    struct consumer {
+      std::size_t left;
+      Next next;
+      bool push(In value)
+      {
+        if(left == 0) return false;
+        --left;
+        return next.push(std::forward<In>(value)) && left > 0;
+      }
+      void finish() { next.finish(); }
+    };
+    return consumer{count, std::move(next)};
+  }
+};
+
+// passes on a span of `size` values at a time, the last one may be shorter; the span is valid until the next
+// value reaches the stage
+struct batch_stage : stage_tag {
+  std::size_t size;
+
+  template<typename In>
+  using output = std::span<const std::remove_cvref_t<In>>;
+
+  template<typename In, typename Next>
+  auto bind(Next next) &&
+  {
+    struct consumer {
+      std::vector<std::remove_cvref_t<In>> buffer;
+      std::size_t size;
+      Next next;
+      bool push(In value)
+      {
+        // cleared only now, so that the span pushed last is still valid
+        if(buffer.size() == size) buffer.clear();
+        buffer.push_back(std::forward<In>(value));
+        return buffer.size() < size || next.push(output<In>(buffer));
+      }
+      void finish()
+      {
+        if(!buffer.empty() && buffer.size() < size) next.push(output<In>(buffer));
+        next.finish();
+      }
+    };
+    std::vector<std::remove_cvref_t<In>> buffer;
+    buffer.reserve(size);
+    return consumer{std::move(buffer), size, std::move(next)};
+  }
+};
+
+template<typename F>
+map_stage<std::decay_t<F>> map(F&& f)
+{
+  return {{}, std::forward<F>(f)};
+}
+template<typename P>
+filter_stage<std::decay_t<P>> filter(P&& pred)
+{
+  return {{}, std::forward<P>(pred)};
+}
+inline take_stage take(std::size_t count) { return {{}, count}; }
+inline batch_stage batch(std::size_t size) { return {{}, size > 0 ? size : 1}; }
+
+namespace detail {
+
+template<typename In, typename... Stages>
+struct output_of {
+  using type = In;
+};
+template<typename In, typename Stage, typename... Rest>
+struct output_of<In, Stage, Rest...> : output_of<typename Stage::template output<In>, Rest...> {};
+
+template<typename In, typename Terminal>
+Terminal bind_all(Terminal terminal)
+{
+  return terminal;
+}
+template<typename In, typename Terminal, typename Stage, typename... Rest>
+auto bind_all(Terminal terminal, Stage&& stage, Rest&&... rest)
+{
+  using next_input = typename std::remove_cvref_t<Stage>::template output<In>;
+  return std::move(stage).template bind<In>(bind_all<next_input>(std::move(terminal), std::move(rest)...));
+}
+
+} // namespace detail
+
+template<std::ranges::input_range Source, typename... Stages>
+  requires std::ranges::view<Source>
+class stream {
+public:
+  using input = std::ranges::range_reference_t<Source>;
+  // the type of the values reaching the sink
+  using output = typename detail::output_of<input, Stages...>::type;
+
+  stream(Source source, std::tuple<Stages...> stages) : source_(std::move(source)), stages_(std::move(stages)) {}
+
+  template<stage S>
+  friend auto operator|(stream s, S&& st)
+  {
+    return stream<Source, Stages..., std::remove_cvref_t<S>>(
+      std::move(s.source_), std::tuple_cat(std::move(s.stages_), std::tuple(std::forward<S>(st))));
+  }
+  template<sink S>
+  friend decltype(auto) operator|(stream s, S&& sk)
+  {
+    return std::forward<S>(sk).template run<output>(std::move(s));
+  }
+
+  Source& source() noexcept { return source_; }
+
+  // moves the stages into a single consumer feeding `terminal`
+  template<typename Terminal>
+  auto make_chain(Terminal terminal)
+  {
+    return std::apply(
+      [&](auto&... st) { return detail::bind_all<input>(std::move(terminal), std::move(st)...); }, stages_);
+  }
+
+  // pushes the source through the stages into `terminal`
+  template<typename Terminal>
+  void drive(Terminal terminal) &&
+  {
+    auto chain = make_chain(std::move(terminal));
+    for(auto&& value : source_)
+      if(!chain.push(std::forward<decltype(value)>(value))) break;
+    chain.finish();
+  }
+
+private:
+  Source source_;
+  [[no_unique_address]] std::tuple<Stages...> stages_;
+};
+
+template<std::ranges::viewable_range R, stage S>
+auto operator|(R&& range, S&& st)
+{
+  return stream<std::views::all_t<R>, std::remove_cvref_t<S>>(std::views::all(std::forward<R>(range)),
+                                                               std::tuple(std::forward<S>(st)));
+}
+template<std::ranges::viewable_range R, sink S>
+decltype(auto) operator|(R&& range, S&& sk)
+{
+  return stream<std::views::all_t<R>>(std::views::all(std::forward<R>(range)), {}) | std::forward<S>(sk);
+}
+
+template<typename F>
+struct for_each_sink : sink_tag {
+  F f;
+
+  template<typename In, typename Stream>
+  void run(Stream s) &&
+  {
+    struct consumer {
+      F* f;
+      bool push(In value)
+      {
+        std::invoke(*f, std::forward<In>(value));
+        return true;
+      }
+      static void finish() noexcept {}
+    };
+    std::move(s).drive(consumer{&f});
+  }
+};
+
+template<typename T, typename F>
+struct fold_sink : sink_tag {
+  T init;
+  F f;
+
+  template<typename In, typename Stream>
+  T run(Stream s) &&
+  {
+    struct consumer {
+      T* acc;
+      F* f;
+      bool push(In value)
+      {
+        *acc = std::invoke(*f, std::move(*acc), std::forward<In>(value));
+        return true;
+      }
+      static void finish() noexcept {}
+    };
+    T acc = std::move(init);
+    std::move(s).drive(consumer{&acc, &f});
+    return acc;
+  }
+};
+
+struct to_vector_sink : sink_tag {
+  template<typename In, typename Stream>
+  std::vector<std::remove_cvref_t<In>> run(Stream s) &&
+  {
+    struct consumer {
+      std::vector<std::remove_cvref_t<In>>* values;
+      bool push(In value)
+      {
+        values->push_back(std::forward<In>(value));
+        return true;
+      }
+      static void finish() noexcept {}
+    };
+    std::vector<std::remove_cvref_t<In>> values;
+    std::move(s).drive(consumer{&values});
+    return values;
+  }
+};
+
+// the values leaving the stages are handed to the coroutine one at a time: the chain stores at most one of them
+// per source element, or per `finish()`, and the task awaits `f` on it before pushing the next one
+template<typename F>
+struct co_for_each_sink : sink_tag {
+  F f;
+
+  template<typename In, typename Stream>
+  task<void> run(Stream s) &&
+  {
+    return drive<In>(std::move(s), std::move(f));
+  }
+
+private:
+  template<typename In, typename Stream>
+  static task<void> drive(Stream s, F f)
+  {
+    using value_type = std::remove_cvref_t<In>;
+    struct consumer {
+      std::optional<value_type>* pending;
+      bool push(In value)
+      {
+        pending->emplace(std::forward<In>(value));
+        return true;
+      }
+      static void finish() noexcept {}
+    };
+
+    std::optional<value_type> pending;
+    auto chain = s.make_chain(consumer{&pending});
+    for(auto&& value : s.source()) {
+      const bool more = chain.push(std::forward<decltype(value)>(value));
+      if(pending) {
+        co_await std::invoke(f, *std::move(pending));
+        pending.reset();
+      }
+      if(!more) break;
+    }
+    chain.finish();
+    if(pending) co_await std::invoke(f, *std::move(pending));
+  }
+};
+
+template<typename F>
+for_each_sink<std::decay_t<F>> for_each(F&& f)
+{
+  return {{}, std::forward<F>(f)};
+}
+template<typename T, typename F>
+fold_sink<T, std::decay_t<F>> fold(T init, F&& f)
+{
+  return {{}, std::move(init), std::forward<F>(f)};
+}
+inline to_vector_sink to_vector() { return {}; }
+template<typename F>
+co_for_each_sink<std::decay_t<F>> co_for_each(F&& f)
+{
+  return {{}, std::forward<F>(f)};
+}
+
+} // namespace pipeline
+
+
+// ********* EXAMPLE *********
+
+#include <chrono>
+#include <iostream>
+
+constexpr long elements = 10'000'000;
+
+// the stages of the benchmark
+constexpr auto triple = [](long x) { return 3 * x; };
+constexpr auto is_even = [](long x) { return x % 2 == 0; };
+constexpr auto increment = [](long x) { return x + 1; };
+constexpr auto not_multiple_of_5 = [](long x) { return x % 5 != 0; };
+constexpr auto add = [](long acc, long x) { return acc + x; };
+
+long hand_written(long n)
+{
+  long sum = 0;
+  for(long i = 0; i < n; ++i) {
+    const long x = triple(i);
+    if(!is_even(x)) continue;
+    const long y = increment(x);
+    if(!not_multiple_of_5(y)) continue;
+    sum = add(sum, y);
+  }
+  return sum;
+}
+
+long fused(long n)
+{
+  using namespace pipeline;
+  return std::views::iota(0L, n) | map(triple) | filter(is_even) | map(increment) | filter(not_multiple_of_5)
+         | fold(0L, add);
+}
+
+generator<long> count(long n)
+{
+  for(long i = 0; i < n; ++i)
+    co_yield i;
+}
+
+template<typename F>
+generator<long> map_each(generator<long> in, F f)
+{
+  for(const long x : in)
+    co_yield f(x);
+}
+
+template<typename P>
+generator<long> filter_each(generator<long> in, P pred)
+{
+  for(const long x : in)
+    if(pred(x)) co_yield x;
+}
+
+long chained(long n)
+{
+  long sum = 0;
+  for(const long x :
+      filter_each(map_each(filter_each(map_each(count(n), triple), is_even), increment), not_multiple_of_5))
+    sum = add(sum, x);
+  return sum;
+}
+
+long measure(const char* name, long (*run)(long))
+{
+  const auto frames = frame_allocations;
+  const auto start = std::chrono::steady_clock::now();
+  const long sum = run(elements);
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << name << ": " << std::chrono::duration<double, std::nano>(elapsed).count() / elements
+            << " ns per element, " << frame_allocations - frames << " frames (sum " << sum << ")\n";
+  return sum;
+}
+
+// stands for an asynchronous write of a batch to a device
+task<void> write(std::span<const long> batch, std::vector<long>& device)
+{
+  device.insert(device.end(), batch.begin(), batch.end());
+  co_return;
+}
+
+int main()
+{
+  using namespace pipeline;
+
+  const long expected = measure("hand-written loop  ", hand_written);
+  const bool ok_fused = measure("fused pipeline     ", fused) == expected;
+  const bool ok_chained = measure("chained generators ", chained) == expected;
+
+  // a generator is a source like any other range
+  std::cout << "first even numbers:";
+  count(1'000) | filter(is_even) | take(5) | for_each([](long x) { std::cout << " " << x; });
+  const auto tripled = std::vector<long>{1, 2, 3} | map(triple) | to_vector();
+  std::cout << "\ntripled: " << tripled.size() << " values, last " << tripled.back() << "\n";
+
+  // only the asynchronous sink has coroutine boundaries: one frame for the pipeline, one per write
+  std::vector<long> device;
+  int writes = 0;
+  const auto frames = frame_allocations;
+  auto t = std::views::iota(0L, 100L) | map(triple) | filter(is_even) | batch(16)
+           | co_for_each([&](std::span<const long> b) {
+               ++writes;
+               return write(b, device);
+             });
+  t.start();
+  std::move(t).get_result();
+  std::cout << "async sink: " << device.size() << " values in " << writes << " writes, "
+            << frame_allocations - frames << " frames\n";
+
+  const bool ok = ok_fused && ok_chained && device.size() == 50 && device.back() == 294;
+  std::cout << (ok ? "OK" : "FAILED") << "\n";
+  return ok ? 0 : 1;
+}